@@ -0,0 +1,274 @@
+#include "main.hpp"
+#include "ponyc_includes.hpp"
+#include "cli_opts.hpp"
+#include "ast_transformations.hpp"
+#include "dump_scope.hpp"
+#include "pos.hpp"
+#include "PonyType.hpp"
+#include "ExpressionTypeResolver.hpp"
+#include "source_index.hpp"
+
+#include <CLI11.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+using namespace std;
+
+struct bench_opts_t {
+	size_t files = 4;
+	size_t classes = 8;
+	size_t members = 16;
+	// length of the provides chain of every class
+	size_t depth = 4;
+	// length of the a.b.c.d chain in every class
+	size_t chain = 8;
+	// typeparams of the generic class in every file
+	size_t typeparams = 4;
+	size_t iterations = 20;
+	unsigned seed = 1;
+	bool keep = false;
+};
+
+struct bench_caret_t {
+	string file;
+	size_t line;
+	size_t pos;
+};
+
+struct bench_package_t {
+	string path;
+	vector<string> files;
+	vector<string> types;
+	vector<bench_caret_t> carets;
+};
+
+/**
+ * @brief writes lines while keeping track of the line number, so carets can be recorded
+ */
+class pony_writer_t {
+private:
+	ostringstream m_Out;
+	size_t m_Line = 1;
+
+public:
+	void line(const string &text) {
+		m_Out << text << '\n';
+		m_Line++;
+	}
+
+	// line the next call to line() writes
+	size_t currentLine() const { return m_Line; }
+
+	string str() const { return m_Out.str(); }
+};
+
+static string generate_file(size_t file, const bench_opts_t &opts, bench_package_t &package) {
+	pony_writer_t out;
+	string prefix = to_string(file);
+	string path = package.path + "/bench" + prefix + ".pony";
+
+	for (size_t d = 0; d < opts.depth; d++) {
+		string trait = "T" + prefix + "x" + to_string(d);
+		out.line("trait " + trait + (d > 0 ? " is T" + prefix + "x" + to_string(d - 1) : ""));
+		out.line("  fun t" + prefix + "x" + to_string(d) + "(): U32 => " + to_string(d));
+		out.line("");
+	}
+
+	string generic = "G" + prefix;
+	string params, args;
+	for (size_t t = 0; t < opts.typeparams; t++) {
+		params += (t > 0 ? ", A" : "A") + to_string(t) + ": Any val";
+		args += t > 0 ? ", U32" : "U32";
+	}
+	if (opts.typeparams > 0) {
+		out.line("class " + generic + "[" + params + "]");
+		for (size_t t = 0; t < opts.typeparams; t++)
+			out.line("  fun get" + to_string(t) + "(a: A" + to_string(t) + "): A" + to_string(t) + " => a");
+		out.line("");
+		package.types.push_back(generic);
+	}
+
+	for (size_t c = 0; c < opts.classes; c++) {
+		string name = "C" + prefix + "x" + to_string(c);
+		out.line("class " + name + (opts.depth > 0 ? " is T" + prefix + "x" + to_string(opts.depth - 1) : ""));
+		out.line("  var count: U32 = 0");
+		for (size_t m = 0; m < opts.members; m++) {
+			if (m % 2 == 0)
+				out.line("  var f" + to_string(m) + ": String = \"\"");
+			else
+				out.line("  fun m" + to_string(m) + "(): " + name + " => this");
+		}
+		out.line("  fun next(): " + name + " => this");
+		out.line("");
+
+		string chain = "    this";
+		out.line("  fun chain(): " + name + " =>");
+		for (size_t l = 0; l < opts.chain; l++) {
+			chain += ".next()";
+			// caret inside the `next` just added
+			package.carets.push_back(bench_caret_t{path, out.currentLine(), chain.size() - 4});
+		}
+		out.line(chain);
+		out.line("");
+
+		if (opts.typeparams > 0) {
+			string call = "    g.get0(0)";
+			out.line("  fun inst(g: " + generic + "[" + args + "]): U32 =>");
+			// caret inside `get0`
+			package.carets.push_back(bench_caret_t{path, out.currentLine(), call.size() - 5});
+			out.line(call);
+			out.line("");
+		}
+
+		package.types.push_back(name);
+	}
+
+	return out.str();
+}
+
+static bench_package_t generate_package(const bench_opts_t &opts) {
+	bench_package_t package;
+	string dir = (fs::temp_directory_path() / "pony_intellisense_bench_XXXXXX").string();
+	if (mkdtemp(&dir[0]) == nullptr) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	package.path = dir;
+
+	for (size_t file = 0; file < opts.files; file++) {
+		string content = generate_file(file, opts, package);
+		package.files.push_back(package.path + "/bench" + to_string(file) + ".pony");
+		ofstream(package.files.back()) << content;
+	}
+
+	return package;
+}
+
+static void report(const string &name, vector<double> samples) {
+	if (samples.empty()) {
+		printf("%-20s no samples\n", name.c_str());
+		return;
+	}
+
+	sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) { return samples[(size_t) (p * (samples.size() - 1))]; };
+	printf("%-20s n=%-6zu p50=%-10.1f p90=%-10.1f p99=%-10.1f max=%-10.1f us\n", name.c_str(), samples.size(),
+	       percentile(0.5), percentile(0.9), percentile(0.99), samples.back());
+}
+
+static double time_us(const function<void()> &work) {
+	auto start = chrono::steady_clock::now();
+	work();
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	stringtab_init();
+	pony_ctx();
+
+	bench_opts_t opts;
+	CLI::App app{"Pony Intellisense Benchmarks"};
+	app.add_option("--files", opts.files, "files in the generated package", true);
+	app.add_option("--classes", opts.classes, "classes per file", true);
+	app.add_option("--members", opts.members, "members per class", true);
+	app.add_option("--depth", opts.depth, "length of each class' provides chain", true);
+	app.add_option("--chain", opts.chain, "length of the call chain in each class", true);
+	app.add_option("--typeparams", opts.typeparams, "typeparams of the generic class in each file", true);
+	app.add_option("--iterations", opts.iterations, "samples per benchmark", true);
+	app.add_option("--seed", opts.seed, "seed for picking carets", true);
+	app.add_flag("--keep", opts.keep, "keep the generated package");
+
+	CLI11_PARSE(app, argc, argv);
+
+	bench_package_t package = generate_package(opts);
+	printf("package %s: %zu files, %zu types, %zu carets\n", package.path.c_str(), package.files.size(),
+	       package.types.size(), package.carets.size());
+
+	cli_opts_t options{};
+	options.path = package.path;
+	options.file = package.files.front();
+
+	// every sample loads into a fresh pass_opt, only the last program is kept for the queries below
+	vector<double> load_samples;
+	for (size_t i = 0; i < opts.iterations; i++) {
+		if (options.program != nullptr) {
+			// the caches are keyed by AST nodes of the previous program
+			PonyType::clearMemberCache();
+			ExpressionTypeResolver::clearCache();
+			ast_free(options.program);
+			options.program = nullptr;
+			pass_opt_done(&options.pass_opt);
+		}
+
+		if (!init_pass_opt(options.pass_opt))
+			return 1;
+
+		bool loaded = false;
+		load_samples.push_back(time_us([&] {
+			loaded = load_program(options, options.pass_opt, options.program);
+		}));
+
+		if (!loaded) {
+			errors_print(options.pass_opt.check.errors);
+			return 1;
+		}
+	}
+	report("load_program", load_samples);
+
+	mt19937 random(opts.seed);
+	uniform_int_distribution<size_t> pick_caret(0, package.carets.empty() ? 0 : package.carets.size() - 1);
+	ast_t *package_ast = ast_child(options.program);
+
+	vector<double> source_index_samples, find_samples, scope_samples;
+	for (size_t i = 0; i < opts.iterations && !package.carets.empty(); i++) {
+		const bench_caret_t &caret = package.carets[pick_caret(random)];
+
+		// build the module's index on its own, so find_identifier_at below only measures the lookup
+		ast_t *module = find_module(package_ast, stringtab(caret.file.c_str()));
+		SourceIndex::invalidate(module);
+		source_index_samples.push_back(time_us([&] { SourceIndex::forModule(module); }));
+
+		find_samples.push_back(time_us([&] {
+			find_identifier_at(package_ast, &options.pass_opt, caret_t(caret.line, caret.pos), caret.file);
+		}));
+
+		cli_opts_t query = options;
+		query.file = caret.file;
+		query.line = caret.line;
+		query.pos = caret.pos;
+		ostringstream out;
+		scope_samples.push_back(time_us([&] { dump_scope(query, out); }));
+	}
+	report("source_index", source_index_samples);
+	report("find_identifier_at", find_samples);
+	report("dump_scope", scope_samples);
+
+	vector<double> member_samples;
+	for (size_t i = 0; i < opts.iterations; i++) {
+		for (auto &name : package.types) {
+			ast_t *def = ast_get(package_ast, stringtab(name.c_str()), nullptr);
+			if (def == nullptr)
+				continue;
+
+			PonyType type = PonyType::fromDefinition(def);
+			// measure collecting the members, not the cache
+			PonyType::clearMemberCache();
+			ExpressionTypeResolver::clearCache();
+			member_samples.push_back(time_us([&] { type.getMembers(&options.pass_opt); }));
+		}
+	}
+	report("getMembers", member_samples);
+
+	if (!opts.keep)
+		fs::remove_all(package.path);
+
+	return 0;
+}
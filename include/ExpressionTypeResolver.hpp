@@ -7,38 +7,89 @@
 #include "PonyType.hpp"
 
 #include <stack>
+#include <vector>
+#include <chrono>
+#include <cstddef>
 
-ast_t *resolve(ast_t *ast, pass_opt_t *pass_opt);
+// what a frame does with the type produced by the frames pushed on top of it
+enum class resolve_step_t {
+	// the frame's expression has that type
+	expression,
+	// replace it with the type of the member named by the right side of the frame's expression
+	member_access,
+	// apply the typeargs of the frame's TK_QUALIFY to it
+	qualify,
+	// collect it as element of the frame's union, intersection or tuple type
+	compose
+};
 
 class type_resolve_frame_t {
 public:
 	ast_t *m_Expression;
+	// used to resolve typeparams etc within the type instance declaring the expression
+	std::optional<PonyType> m_Context;
+	resolve_step_t m_Step;
+	// compose: the element currently being resolved and the types of those before it
+	ast_t *m_Element = nullptr;
+	std::vector<PonyType> m_Elements;
 	const pony_refcap_t m_ViewpointCap;
 public:
 	explicit type_resolve_frame_t(ast_t *expression,
+	                              std::optional<PonyType> context = std::nullopt,
+	                              resolve_step_t step = resolve_step_t::expression,
 	                              pony_refcap_t = pony_refcap_t::unknown);
 };
 
+/**
+ * @brief bounds the work of one top level resolve including the resolvers nested within it
+ */
+struct resolve_budget_t {
+	size_t max_steps = 10000;
+	std::chrono::milliseconds max_time{200};
+};
+
 class ExpressionTypeResolver {
 private:
+	ast_t *m_Expression;
 	std::stack<type_resolve_frame_t> m_Frames;
 	pass_opt_t *m_PassOpt;
 
-	// use to resolve typeparams etc within the type instance declaring the expression
+	// context of the root expression
 	std::optional<PonyType> m_ContextType;
 
 	std::optional<PonyType> m_Type;
 
+	// resolution ran out of budget, it might succeed with a larger one
+	bool m_Partial = false;
+
+	void push(ast_t *expression, const type_resolve_frame_t &from,
+	          resolve_step_t step = resolve_step_t::expression);
+	bool unwind();
+	std::optional<PonyType> fail();
+	bool applyStep(type_resolve_frame_t &frame);
+
 	bool resolveExpression(type_resolve_frame_t &frame);
 	bool resolveReference(type_resolve_frame_t &frame);
 	bool resolveLiteral(type_resolve_frame_t &frame);
 	bool resolveNominal(type_resolve_frame_t &frame);
+	bool resolveAlias(ast_t *alias, ast_t *typeargs);
 	bool resolveAssign(type_resolve_frame_t &frame);
 	bool resolveQualify(type_resolve_frame_t &frame);
 	bool resolveMemberAccess(type_resolve_frame_t &frame);
+	bool resolveComposite(type_resolve_frame_t &frame);
 	bool resolveArrow(type_resolve_frame_t &frame);
 public:
 	// TODO constructor taking PonyType thistype for resolving such references (eg (-> thistype (typeparamref (id A))))
 	ExpressionTypeResolver(ast_t *expression, pass_opt_t *pass_opt);
 	std::optional<PonyType> resolve(std::optional<PonyType> context = std::nullopt);
+
+	bool isPartial() const { return m_Partial; }
+
+	static void setBudget(const resolve_budget_t &budget);
+
+	/**
+	 * @brief results are cached per expression and context type across all resolvers,
+	 * hits and misses are counted as resolver_cache_hits/resolver_cache_misses in the --stats report
+	 */
+	static void clearCache();
 };
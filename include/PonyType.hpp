@@ -6,6 +6,7 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <optional>
 
 #include <scope.pb.h>
 
@@ -28,17 +29,21 @@ enum class pony_refcap_t {
 };
 
 struct PonyMember;
-
-// TODO somehow represent unions,intersections and tuples
+struct composite_type_t;
+
+/**
+ * @brief handle to a type definition and its typeargs, cheap to copy around
+ *
+ * Names and docstrings are stringtab entries owned by the AST.
+ * Unions, intersections and tuples have no definition and point to an interned composite_type_t instead.
+ */
 class PonyType {
 private:
-	ast_t *m_Def;
-	std::string m_Name;
-	std::string m_DocString;
-	std::vector<ast_t *> m_TypeParams;
-	std::vector<ast_t *> m_Provides;
+	ast_t *m_Def = nullptr;
+	ast_t *m_TypeArgs = nullptr;
+	const composite_type_t *m_Composite = nullptr;
 
-	ast_t *m_TypeArgs;
+	explicit PonyType(const composite_type_t *composite) : m_Composite(composite) {}
 
 protected:
 	explicit PonyType(ast_t *definition);
@@ -46,26 +51,71 @@ protected:
 public:
 	static PonyType fromDefinition(ast_t *definition);
 
+	/**
+	 * @param kind TK_UNIONTYPE, TK_ISECTTYPE or TK_TUPLETYPE
+	 * @return handle to the interned composite of the elements
+	 */
+	static PonyType composite(token_id kind, const std::vector<PonyType> &elements);
+
+	/**
+	 * @return the type definition, nullptr for composite types
+	 */
 	ast_t *definition() const { return m_Def; }
 
-	std::string name() const { return m_Name; }
+	const composite_type_t *composite() const { return m_Composite; }
+
+	const char *name() const;
 
-	std::string docstring() const { return m_DocString; }
+	/**
+	 * @return the docstring, empty if the definition has none
+	 */
+	const char *docstring() const;
+
+	ast_t *typeargs() const { return m_TypeArgs; }
 
 	void setTypeargs(ast_t *typeargs);
 
-	std::vector<PonyMember> getMembers(pass_opt_t *pass_opt) const;
+	/**
+	 * @param partial set if resolving ran out of budget, such a table lacks types or provided members
+	 * and is not cached, later calls collect it again
+	 * @return members including provided ones, cached per definition and typeargs
+	 */
+	const std::vector<PonyMember> &getMembers(pass_opt_t *pass_opt, bool *partial = nullptr) const;
+
+	/**
+	 * @brief frees the uncached partial tables, references returned for them become invalid
+	 */
+	static void dropPartialMembers();
+
+	/**
+	 * @brief drops all cached member tables and typearg substitutions,
+	 * any reparsed module may have changed a provides chain or a typearg
+	 */
+	static void clearMemberCache();
+
+	/**
+	 * @brief looks up the type bound to a typeparam, typeargs are resolved once per (definition, typeargs)
+	 */
+	std::optional<PonyType> getTypearg(const char *name, pass_opt_t *pass_opt) const;
+};
 
-	std::optional<PonyType> getTypearg(std::string &name, pass_opt_t *pass_opt);
+struct composite_type_t {
+	token_id kind;
+	std::vector<PonyType> elements;
+	// eg "(String | None)", a stringtab entry
+	const char *name;
 };
 
+/**
+ * @brief member record referencing the member's definition and stringtab entries directly
+ */
 struct PonyMember {
 private:
-	ast_t *m_Definition;
-	std::string m_Name;
-	std::string m_Docstring;
+	ast_t *m_Definition = nullptr;
+	const char *m_Name = "";
+	const char *m_Docstring = "";
 	std::optional<PonyType> m_Type;
-	pony_refcap_t m_Capability;
+	pony_refcap_t m_Capability = pony_refcap_t::unknown;
 public:
 	SymbolKind m_Kind;
 
@@ -73,17 +123,17 @@ public:
 
 	void set_definition(ast_t *definition) { m_Definition = definition; }
 
-	void set_name(const std::string &m_Name);
+	void set_name(const char *m_Name);
 
-	void set_docstring(const std::string &m_Docstring);
+	void set_docstring(const char *m_Docstring);
 
 	void set_type(const std::optional<PonyType> &m_Type);
 
 	void set_capability(pony_refcap_t m_Capability);
 
-	const std::string &get_name() const;
+	const char *get_name() const;
 
-	const std::string &get_docstring() const;
+	const char *get_docstring() const;
 
 	const std::optional<PonyType> &get_type() const;
 
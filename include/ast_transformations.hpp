@@ -17,10 +17,24 @@ struct pass_opt_data_guard {
 };
 
 /**
- * @return ast nodes ordered by source location
+ * @param tree package containing sourcefile
  */
-std::vector<ast_t *> tree_to_sourceloc_ordered_sequence(ast_t *tree, pass_opt_t *options, const char *file);
-
 ast_t *find_identifier_at(ast_t *tree, pass_opt_t *opt, caret_t const &position, std::string const &sourcefile);
 
 ast_t *ast_first_child_of_type(ast_t *parent, token_id id);
+
+/**
+ * @return the TK_MODULE parsed from file (a stringtab entry) or nullptr
+ */
+ast_t *find_module(ast_t *package, const char *file);
+
+/**
+ * @return the entity member containing line, the entity itself if line is on its
+ * header, or module if line precedes every entity
+ */
+ast_t *enclosing_declaration(ast_t *module, size_t line);
+
+/**
+ * @brief narrows enclosing_declaration down through the statement sequences containing line
+ */
+ast_t *enclosing_statement(ast_t *module, size_t line);
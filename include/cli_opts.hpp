@@ -14,6 +14,25 @@ struct cli_opts_t {
 	std::string file;
 	size_t line, pos;
 
+	// write results as length-delimited records as soon as they are produced
+	bool stream;
+
+	// only complete names starting with prefix, at most limit of them (0 for all)
+	std::string prefix;
+	size_t limit;
+
+	// name to look up across all loaded packages
+	std::string symbol_query;
+
+	// only load the modules of the package that file reaches, and the packages they use
+	bool reachable_only;
+
+	// stub method bodies outside the caret before running the passes
+	bool skip_bodies;
+
+	// directory for snapshots reused across runs, empty disables them
+	std::string cache_dir;
+
 	ast_t *program;
 	pass_opt_t pass_opt;
 };
\ No newline at end of file
@@ -5,4 +5,6 @@
 
 #include "cli_opts.hpp"
 
-void dump_ast(cli_opts_t options);
+#include <ostream>
+
+void dump_ast(cli_opts_t options, std::ostream &out);
@@ -6,4 +6,6 @@
 
 #include "cli_opts.hpp"
 
-void dump_scope(cli_opts_t &options);
+#include <ostream>
+
+void dump_scope(cli_opts_t &options, std::ostream &out);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include <google/protobuf/message_lite.h>
+
+/**
+ * @brief reads one varint32 length-prefixed record
+ * @return false on EOF or a truncated record
+ */
+bool read_delimited(std::istream &in, std::string &record);
+
+/**
+ * @brief writes one varint32 length-prefixed record
+ */
+void write_delimited(std::ostream &out, const std::string &record);
+
+void write_delimited(std::ostream &out, const google::protobuf::MessageLite &message);
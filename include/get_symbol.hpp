@@ -2,4 +2,6 @@
 
 #include <cli_opts.hpp>
 
-void get_symbol_command(cli_opts_t &options);
+#include <ostream>
+
+void get_symbol_command(cli_opts_t &options, std::ostream &out);
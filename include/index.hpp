@@ -0,0 +1,15 @@
+#pragma once
+
+#include "cli_opts.hpp"
+
+#include <ostream>
+
+/**
+ * @brief writes a FileIndex mapping every identifier of --file to its definition
+ */
+void index_file_command(cli_opts_t &options, std::ostream &out);
+
+/**
+ * @brief writes a PackageIndex holding the FileIndex of every module in the --path package
+ */
+void index_package_command(cli_opts_t &options, std::ostream &out);
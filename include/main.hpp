@@ -3,5 +3,22 @@
 #include "ponyc_includes.hpp"
 #include "cli_opts.hpp"
 
+/**
+ * @brief sets up pass and ponyc, once per pass_opt_t, before load_program
+ */
+bool init_pass_opt(pass_opt_t &pass);
+
+/**
+ * @brief parses the package at options.path and builtin into program and resolves names
+ */
+bool load_program(cli_opts_t &options, pass_opt_t &pass, ast_t *&program);
+
 bool load_program_from_options(cli_opts_t &options, pass_opt_t &pass, ast_t *&program);
 
+/**
+ * @brief replaces the module parsed from file with one parsed from content and
+ * runs the passes up to PASS_NAME_RESOLUTION on it, leaving every other module untouched
+ * @return false if parsing or name resolution reported errors,
+ * the previous module is only kept if the new content did not parse
+ */
+bool reparse_module(cli_opts_t &options, const std::string &file, const char *content);
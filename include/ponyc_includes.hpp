@@ -9,6 +9,7 @@ extern "C" {
 #include <common/paths.h>
 #include <ast/parserapi.h>
 #include <ast/treecheck.h>
+#include <ast/frame.h>
 #include <pkg/package.h>
 #include <pass/pass.h>
 #include <options/options.h>
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "cli_opts.hpp"
+
+#include <CLI11.hpp>
+#include <ostream>
+
+#define CARET_OPT(cmd, opts) { \
+  (cmd)->add_option("--line", (opts).line, "line to inspect", false);\
+  (cmd)->add_option("--pos", (opts).pos, "position on line to inspect", false);\
+  }
+
+/**
+ * @brief adds the subcommands that answer a query against options.program
+ * @param out stream the query response is written to
+ */
+void add_query_subcommands(CLI::App &app, cli_opts_t &options, std::ostream &out);
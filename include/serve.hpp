@@ -0,0 +1,26 @@
+#pragma once
+
+#include "cli_opts.hpp"
+
+#include <istream>
+
+/**
+ * @brief answers length-delimited queries read from stdin against the resident options.program
+ *
+ * Every request is a single argument line as it would be passed to the cli
+ * (eg. "--file main.pony dump-scope --line 3 --pos 7"), every response is the
+ * output of that subcommand, both prefixed with their length as a varint32.
+ * Everything following the first newline of a request replaces the content of
+ * --file, only that module gets reparsed before the query is answered.
+ * A request that fails to parse is answered with an empty response.
+ */
+void serve_command(cli_opts_t &options);
+
+/**
+ * @brief answers one query per line of in against the resident options.program
+ *
+ * Lines are argument lines like serve requests, without new file content.
+ * Empty lines and lines starting with '#' are skipped. Every answer is written
+ * to stdout prefixed with its length as a varint32, in the order of the queries.
+ */
+void batch_command(cli_opts_t &options, std::istream &in);
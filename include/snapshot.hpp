@@ -0,0 +1,148 @@
+#pragma once
+
+#include "ponyc_includes.hpp"
+#include "cli_opts.hpp"
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// part of every cache key, set by CMake from lib/ponyc/VERSION
+#ifndef PONYC_VERSION
+#define PONYC_VERSION "unknown"
+#endif
+
+/**
+ * @brief FNV-1a over data, chain calls by passing the previous result as seed
+ */
+uint64_t content_hash(const void *data, size_t len, uint64_t seed = 14695981039346656037ull);
+
+/**
+ * @brief one contiguous piece of a file written by write_file_atomically
+ */
+struct file_chunk_t {
+	const void *data;
+	size_t size;
+};
+
+/**
+ * @brief writes chunks to a temporary file and renames it to path,
+ * so concurrent runs mapping path never see a partially written file
+ */
+bool write_file_atomically(const std::string &path, std::initializer_list<file_chunk_t> chunks);
+
+/**
+ * @brief read-only memory mapping of a whole file
+ */
+class MappedFile {
+private:
+	void *m_Data = nullptr;
+	size_t m_Size = 0;
+
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string &path);
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile();
+
+	bool valid() const { return m_Data != nullptr; }
+
+	const char *data() const { return (const char *) m_Data; }
+
+	size_t size() const { return m_Size; }
+};
+
+/*
+ * On disk layout of the builtin snapshot, every string is an offset into the
+ * trailing string pool. Types are sorted by name, members and parameters of a
+ * type are stored contiguously.
+ */
+struct snapshot_header_t {
+	char magic[8];
+	uint64_t key;
+	uint32_t type_count;
+	uint32_t member_count;
+	uint32_t param_count;
+	uint32_t strings_size;
+};
+
+struct snapshot_type_t {
+	uint32_t name;
+	uint32_t docstring;
+	uint32_t file;
+	uint32_t line, column;
+	uint32_t kind;
+	uint32_t typeparam_count;
+	uint32_t first_member, member_count;
+};
+
+struct snapshot_member_t {
+	uint32_t name;
+	uint32_t docstring;
+	uint32_t type_name;
+	uint32_t type_docstring;
+	uint32_t file;
+	uint32_t line, column;
+	uint32_t kind;
+	uint32_t first_param, param_count;
+};
+
+struct snapshot_param_t {
+	uint32_t name;
+	uint32_t type_name;
+	uint32_t type_docstring;
+};
+
+/**
+ * @brief resolved declarations of the builtin package, memory mapped from the cache directory
+ */
+class BuiltinSnapshot {
+private:
+	MappedFile m_File;
+	const snapshot_header_t *m_Header = nullptr;
+	const snapshot_type_t *m_Types = nullptr;
+	const snapshot_member_t *m_Members = nullptr;
+	const snapshot_param_t *m_Params = nullptr;
+	const char *m_Strings = nullptr;
+
+public:
+	/**
+	 * @param key snapshot is rejected unless it was written with the same key
+	 */
+	BuiltinSnapshot(const std::string &path, uint64_t key);
+
+	bool valid() const { return m_Header != nullptr; }
+
+	const snapshot_type_t *findType(const char *name) const;
+
+	const snapshot_member_t *members(const snapshot_type_t &type) const { return m_Members + type.first_member; }
+
+	const snapshot_param_t *params(const snapshot_member_t &member) const { return m_Params + member.first_param; }
+
+	const char *str(uint32_t offset) const { return m_Strings + offset; }
+};
+
+/**
+ * @return hash over the ponyc version and the sources of every module in packages
+ */
+uint64_t sources_key(const std::vector<ast_t *> &packages);
+
+/**
+ * @return hash over the snapshot format, the ponyc version and the sources of every module in builtin
+ */
+uint64_t builtin_snapshot_key(ast_t *builtin);
+
+bool write_builtin_snapshot(const std::string &path, uint64_t key, ast_t *builtin, pass_opt_t *opt);
+
+/**
+ * @brief maps the snapshot for builtin on first use, (re)writing it first if it is missing or stale
+ * @return the snapshot or nullptr if there is no cache dir or it could not be written
+ */
+const BuiltinSnapshot *builtin_snapshot(cli_opts_t &options, ast_t *builtin);
+
+/**
+ * @return whether definition belongs to the builtin package of its program
+ */
+bool is_builtin_definition(ast_t *definition);
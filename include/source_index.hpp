@@ -0,0 +1,31 @@
+#pragma once
+
+#include "ponyc_includes.hpp"
+#include "pos.hpp"
+
+#include <vector>
+
+/**
+ * @brief identifiers of one module ordered by source position
+ */
+class SourceIndex {
+private:
+	std::vector<ast_t *> m_Ids;
+
+public:
+	explicit SourceIndex(ast_t *module);
+
+	/**
+	 * @return the TK_ID whose name spans position or nullptr
+	 */
+	ast_t *identifierAt(caret_t const &position) const;
+
+	const std::vector<ast_t *> &identifiers() const { return m_Ids; }
+
+	/**
+	 * @return index of module, built on first use and kept until invalidated
+	 */
+	static const SourceIndex &forModule(ast_t *module);
+
+	static void invalidate(ast_t *module);
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+// type_resolution happens during scope_walk, so phases may overlap
+enum class stats_phase_t {
+	builtin_load,
+	package_parse,
+	name_resolution,
+	scope_walk,
+	type_resolution,
+	serialization,
+	count
+};
+
+enum class stats_counter_t {
+	nodes_visited,
+	resolver_frames,
+	resolver_cache_hits,
+	resolver_cache_misses,
+	members_collected,
+	bytes_serialized,
+	count
+};
+
+/**
+ * @brief turns recording on, everything below is a no-op until then
+ */
+void stats_enable();
+
+bool stats_enabled();
+
+void stats_count(stats_counter_t counter, size_t amount = 1);
+
+void stats_add_time(stats_phase_t phase, std::chrono::steady_clock::duration duration);
+
+/**
+ * @brief writes one `key value` line per phase and counter plus the peak RSS, framed by `stats begin`/`stats end`
+ *
+ * Nothing is written if nothing was recorded since the last reset.
+ */
+void stats_report(std::ostream &out);
+
+void stats_reset();
+
+/**
+ * @brief adds the time until it goes out of scope to phase
+ */
+class stats_timer_t {
+private:
+	stats_phase_t m_Phase;
+	bool m_Running;
+	std::chrono::steady_clock::time_point m_Start;
+
+public:
+	explicit stats_timer_t(stats_phase_t phase) : m_Phase(phase), m_Running(stats_enabled()) {
+		if (m_Running)
+			m_Start = std::chrono::steady_clock::now();
+	}
+
+	~stats_timer_t() {
+		if (m_Running)
+			stats_add_time(m_Phase, std::chrono::steady_clock::now() - m_Start);
+	}
+
+	stats_timer_t(const stats_timer_t &) = delete;
+	stats_timer_t &operator=(const stats_timer_t &) = delete;
+};
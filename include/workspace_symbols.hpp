@@ -0,0 +1,20 @@
+#pragma once
+
+#include "cli_opts.hpp"
+
+#include <ostream>
+
+/**
+ * @brief writes a Scope of the declarations across all loaded packages
+ * whose names match options.symbol_query, best matches first
+ *
+ * Matches are ranked exact, prefix, substring, then fuzzy (the query's characters in order),
+ * case-insensitively. A trailing '*' is ignored, so "Http*" is a prefix query like "Http".
+ * At most --limit symbols are written, 100 if it is 0.
+ */
+void workspace_symbols_command(cli_opts_t &options, std::ostream &out);
+
+/**
+ * @brief drops the declaration index, it is rebuilt by the next query
+ */
+void invalidate_workspace_symbols();
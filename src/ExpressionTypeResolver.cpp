@@ -1,33 +1,15 @@
 #include "ExpressionTypeResolver.hpp"
 #include "logging.hpp"
 #include "ast_transformations.hpp"
+#include "stats.hpp"
 
-std::vector<ast_t *> get_nominal_members(ast_t *nominal) {
-	pony_assert(nominal != nullptr);
-	pony_assert(ast_id(nominal) == TK_NOMINAL);
-
-	std::vector<ast_t *> member_vec;
-
-	AST_GET_CHILDREN(nominal, package_id, type_id, typeparams, cap, eph);
-	auto *type = (ast_t *) ast_data(nominal);
-
-	if (type == nullptr)
-		return member_vec;
-
-	AST_GET_CHILDREN(type, _, __, ___, ____, members);
-	for (ast_t *member = ast_child(members); member != nullptr; member = ast_sibling(member))
-		member_vec.push_back(member);
-
-	return member_vec;
-}
-
-bool is_reference_token(token_id id) {
-	return id >= TK_REFERENCE && id < TK_DONTCAREREF;
-}
+#include <chrono>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
-ast_t *resolve_reference(ast_t *ref, pass_opt_t *) {
+static ast_t *resolve_reference(ast_t *ref) {
 	pony_assert(ref != nullptr);
-	pony_assert(is_reference_token(ast_id(ref)));
 
 	ast_t *id = ast_child(ref);
 
@@ -35,228 +17,184 @@ ast_t *resolve_reference(ast_t *ref, pass_opt_t *) {
 	return ast_get(id, ast_name(id), &status);
 }
 
-ast_t *resolve_call(ast_t *call, pass_opt_t *opt) {
-	pony_assert(call != nullptr);
-	pony_assert(ast_id(call) == TK_CALL);
-
-	return resolve(ast_child(call), opt);
-}
-
-ast_t *resolve_nominal(ast_t *nominal, pass_opt_t *) {
+static ast_t *resolve_nominal(ast_t *nominal) {
 	pony_assert(nominal != nullptr);
 	pony_assert(ast_id(nominal) == TK_NOMINAL);
 
 	return (ast_t *) ast_data(nominal);
 }
 
-/**
- * Evaluates the left part of a dot node recursively
- * @param accessor or ref
- * @return type,member or other underlying node described by left.right
- */
-ast_t *resolve_member_access(ast_t *accessor, pass_opt_t *opt) {
-	if (accessor == nullptr)
-		return nullptr;
-
-	LOG("Resolving %s", token_id_desc(ast_id(accessor)));
+ExpressionTypeResolver::ExpressionTypeResolver(ast_t *expression, pass_opt_t *pass_opt)
+		: m_Expression(expression), m_PassOpt(pass_opt) {}
 
-	if (ast_childcount(accessor) < 2)
-		return nullptr;
+// expression and the definition and typeargs of the context type
+typedef std::tuple<ast_t *, ast_t *, ast_t *> resolution_key_t;
 
-	bool is_chaining = ast_id(accessor) == TK_CHAIN;
-	AST_GET_CHILDREN(accessor, left, right);
-
-	pony_assert(ast_id(right) == TK_ID || ast_id(right) == TK_TILDE || ast_id(right) == TK_CHAIN);
+struct resolution_key_hash {
+	size_t operator()(const resolution_key_t &key) const {
+		std::hash<ast_t *> hash;
+		size_t h = hash(std::get<0>(key));
+		h = h * 31 + hash(std::get<1>(key));
+		return h * 31 + hash(std::get<2>(key));
+	}
+};
 
-	token_id left_id = ast_id(left);
+static std::unordered_map<resolution_key_t, std::optional<PonyType>, resolution_key_hash> resolution_cache;
 
-	if (left_id == TK_DOT) {
-		ast_t *prior = nullptr;
+static resolution_key_t resolution_key(const type_resolve_frame_t &frame) {
+	return resolution_key_t(frame.m_Expression,
+	                        frame.m_Context ? frame.m_Context->definition() : nullptr,
+	                        frame.m_Context ? frame.m_Context->typeargs() : nullptr);
+}
 
-		switch (ast_id(left)) {
-			case TK_DOT:
-			case TK_TILDE:
-			case TK_CHAIN: {
-				prior = resolve_member_access(left, opt);
-				break;
-			}
-			case TK_CALL: {
-				ast_t *call_fun = resolve_call(left, opt);
+/**
+ * @brief budget shared by a top level resolve and every resolver nested within it
+ */
+struct resolve_session_t {
+	size_t depth = 0;
+	size_t steps = 0;
+	std::chrono::steady_clock::time_point deadline;
+	bool exhausted = false;
+};
+
+static resolve_budget_t resolve_budget;
+static resolve_session_t resolve_session;
+
+struct resolve_session_guard {
+	resolve_session_guard() {
+		if (resolve_session.depth++ > 0)
+			return;
+
+		resolve_session.steps = 0;
+		resolve_session.exhausted = false;
+		resolve_session.deadline = std::chrono::steady_clock::now() + resolve_budget.max_time;
+	}
 
-				if (call_fun != nullptr) {
-					prior = resolve_nominal(ast_first_child_of_type(call_fun, TK_NOMINAL), opt);
-				}
-				break;
-			}
-			default: {
-			}
-		}
+	~resolve_session_guard() {
+		resolve_session.depth--;
+	}
+};
 
-		if (prior == nullptr)
-			return nullptr;
+static bool take_resolve_step() {
+	if (resolve_session.exhausted)
+		return false;
 
-		if (is_chaining) {
-			LOG("is_chaining short circuiting");
-			return prior;
-		}
+	resolve_session.steps++;
+	// checking the clock every step would cost more than most steps do
+	bool out_of_time = resolve_session.steps % 64 == 0 && std::chrono::steady_clock::now() > resolve_session.deadline;
+	if (resolve_session.steps > resolve_budget.max_steps || out_of_time) {
+		LOG("[ExpressionTypeResolver] aborting after %zu steps", resolve_session.steps);
+		resolve_session.exhausted = true;
+		return false;
+	}
+	return true;
+}
 
-		AST_GET_CHILDREN(prior, _, __, ___, ____, prior_members)
+/*
+ * Every frame on the stack has the type of the frame pushed on top of it, except
+ * for continuation frames which transform that type (member lookup, qualification).
+ * Once a frame produces a type, the stack is unwound: expression frames take the
+ * current type and get cached, continuations are applied to it.
+ */
+std::optional<PonyType> ExpressionTypeResolver::resolve(std::optional<PonyType> context) {
+	m_ContextType = std::move(context);
+	// don't rerun successful resolve
+	if (m_Type)
+		return m_Type;
 
-		if (prior_members == nullptr)
-			return nullptr;
+	// nested resolvers are part of the outermost one's time
+	std::optional<stats_timer_t> timer;
+	if (resolve_session.depth == 0)
+		timer.emplace(stats_phase_t::type_resolution);
 
-		for (ast_t *member = ast_child(prior_members); member != nullptr; member = ast_sibling(member)) {
-			ast_t *member_id = ast_child(member);
-			while (member_id != nullptr && ast_id(member_id) != TK_ID)
-				member_id = ast_sibling(member_id);
+	resolve_session_guard session;
+	std::unordered_set<ast_t *> visited;
+	m_Frames.emplace(m_Expression, m_ContextType);
+	stats_count(stats_counter_t::resolver_frames);
 
-			if (member_id != nullptr && ast_name(member_id) == ast_name(right))
-				return member;
+	for (;;) {
+		if (m_Type) {
+			if (!unwind())
+				return fail();
+			if (m_Frames.empty())
+				return m_Type;
+			// a continuation scheduled more work
+			continue;
 		}
-	} else if (is_reference_token(left_id)) {
-		ast_t *ref = resolve_reference(left, opt);
-
-
-		ast_t *nominal = ast_childidx(ref, 1);
 
-		if (nominal == nullptr)
-			return nullptr;
+		type_resolve_frame_t &frame = m_Frames.top();
 
-		if (is_chaining)
-			return (ast_t *) ast_data(nominal);
-
-		// TODO use PonyType to get members for trait support etc
-		for (auto &it : get_nominal_members(nominal)) {
-			auto member_id = ast_first_child_of_type(it, TK_ID);
-
-			// TODO this fails for inherited members, use PonyType instead
-			if (member_id == nullptr || ast_name(member_id) != ast_name(right))
-				continue;
-
-			/*
-			 * TODO for generic functions, we wont have a return nominal but at (-> thistype (typeparamref (id A) x x) )
-			 */
-			LOG_AST(it);
+		auto cached = resolution_cache.find(resolution_key(frame));
+		if (cached != resolution_cache.end()) {
+			stats_count(stats_counter_t::resolver_cache_hits);
+			if (!cached->second)
+				return fail();
+			m_Type = cached->second;
+			continue;
+		}
+		stats_count(stats_counter_t::resolver_cache_misses);
 
-			return (ast_t *) ast_data(ast_first_child_of_type(it, TK_NOMINAL));
+		// a frame we already passed through can only lead back here
+		if (!visited.insert(frame.m_Expression).second) {
+			LOG("[ExpressionTypeResolver] cycle through %s", token_id_desc(ast_id(frame.m_Expression)));
+			return fail();
 		}
-	}
 
-	return nullptr;
+		if (!take_resolve_step() || !resolveExpression(frame))
+			return fail();
+	}
 }
 
-/**
- * Resolve the underlying type definition given or inferred for ast
- * fun -> return type
- * var -> definition
- * @param ast
- * @param pass_opt
- * @return
- */
-ast_t *resolve(ast_t *ast, pass_opt_t *pass_opt) {
-	pony_assert(ast != nullptr);
-
-	token_id id = ast_id(ast);
-	if (is_reference_token(id)) {
-		return resolve_reference(ast, pass_opt);
-	}
+bool ExpressionTypeResolver::unwind() {
+	while (!m_Frames.empty()) {
+		type_resolve_frame_t &frame = m_Frames.top();
 
-	// TODO handle array literals, strings, tuples etc
-	token_id tokenId = ast_id(ast);
-	switch (tokenId) {
-		case TK_STRING:
-		case TK_FLOAT:
-		case TK_ARRAY:
-		case TK_INT: {
-			const char *builtin_name = tokenId == TK_STRING ?
-			                           "String" :
-			                           tokenId == TK_FLOAT ?
-			                           "Float" :
-			                           tokenId == TK_ARRAY ?
-			                           "Array" :
-			                           "Int";
-			expr_literal(pass_opt, ast, builtin_name);
-			return resolve(ast_type(ast), pass_opt);
+		if (frame.m_Step == resolve_step_t::expression) {
+			resolution_cache.emplace(resolution_key(frame), m_Type);
+		} else if (!take_resolve_step() || !applyStep(frame)) {
+			return false;
+		} else if (!m_Type) {
+			// keep the continuation until the frames it pushed are done
+			return true;
 		}
-		case TK_LITERAL:
-			return ast_type(ast);
-		case TK_DOT:
-		case TK_TILDE:
-		case TK_CHAIN:
-			return resolve_member_access(ast, pass_opt);
-		case TK_CALL:
-			return resolve_call(ast, pass_opt);
-		case TK_VAR:
-		case TK_LET:
-		case TK_FLET:
-		case TK_FVAR:
-		case TK_PARAM:
-		case TK_EMBED: {
-			ast_t *parent = ast_parent(ast);
-			if (parent == nullptr)
-				return nullptr;
 
-			ast_t *nominal = ast_first_child_of_type(ast, TK_NOMINAL);
-			if (nominal != nullptr)
-				return resolve_nominal(nominal, pass_opt);
+		m_Frames.pop();
+	}
+	return true;
+}
 
-			return resolve(ast_childidx(parent, 1), pass_opt);
-		}
-		case TK_FUN:
-		case TK_BE:
-		case TK_NEW: {
-			ast_t *nominal = ast_first_child_of_type(ast, TK_NOMINAL);
-			if (nominal == nullptr) {
-				return nullptr;
-			}
-			return resolve_nominal(nominal, pass_opt);
-		}
-		case TK_SEQ: {
-			// TODO seek for return expressions?
-			ast_t *last = ast_child(ast);
-			return resolve(last, pass_opt);
-		}
-		case TK_RECOVER:
-		case TK_CONSUME: {
-			ast_t *seq_node = ast_childlast(ast);
-			return resolve(seq_node, pass_opt);
-		}
-		case TK_NOMINAL:
-			return resolve_nominal(ast, pass_opt);
-		default: {
-			LOG("Tried to resolve unhandled ast type %s\n", token_id_desc(ast_id(ast)));
-			LOG_AST(ast);
-			pony_assert(false);
-			return nullptr;
-		}
+std::optional<PonyType> ExpressionTypeResolver::fail() {
+	// an exhausted budget says nothing about the expressions, so don't remember that failure
+	m_Partial = resolve_session.exhausted;
+	m_Type.reset();
+
+	// every expression left on the stack depended on the one that failed
+	for (; !m_Frames.empty(); m_Frames.pop()) {
+		if (!m_Partial && m_Frames.top().m_Step == resolve_step_t::expression)
+			resolution_cache.emplace(resolution_key(m_Frames.top()), std::nullopt);
 	}
+	return std::nullopt;
 }
 
-ExpressionTypeResolver::ExpressionTypeResolver(ast_t *expression, pass_opt_t *pass_opt) : m_PassOpt(pass_opt) {
-	m_Frames.emplace(expression);
+void ExpressionTypeResolver::setBudget(const resolve_budget_t &budget) {
+	resolve_budget = budget;
 }
 
-std::optional<PonyType> ExpressionTypeResolver::resolve(std::optional<PonyType> context) {
-	m_ContextType = std::move(context);
-	// don't rerun successful resolve
-	if (m_Type)
-		return m_Type;
+void ExpressionTypeResolver::clearCache() {
+	resolution_cache.clear();
+}
 
-	for (;;) {
-		if (!resolveExpression(m_Frames.top())) {
-			return std::nullopt;
-		} else if (m_Type) {
-			return m_Type;
-		}
-	}
+void ExpressionTypeResolver::push(ast_t *expression, const type_resolve_frame_t &from, resolve_step_t step) {
+	m_Frames.emplace(expression, from.m_Context, step);
+	stats_count(stats_counter_t::resolver_frames);
 }
 
 bool ExpressionTypeResolver::resolveReference(type_resolve_frame_t &frame) {
-	ast_t *resolved = resolve_reference(frame.m_Expression, m_PassOpt);
+	ast_t *resolved = resolve_reference(frame.m_Expression);
 
 	if (resolved != nullptr) {
 		// TODO include viewpoint information
-		m_Frames.emplace(resolved);
+		push(resolved, frame);
 		return true;
 	}
 
@@ -279,21 +217,34 @@ bool ExpressionTypeResolver::resolveLiteral(type_resolve_frame_t &frame) {
 	pony_assert(builtin_name != nullptr);
 
 	expr_literal(m_PassOpt, frame.m_Expression, builtin_name);
-	m_Frames.emplace(ast_type(frame.m_Expression));
+	push(ast_type(frame.m_Expression), frame);
 	return true;
 }
 
 bool ExpressionTypeResolver::resolveNominal(type_resolve_frame_t &frame) {
-	ast_t *resolved = resolve_nominal(frame.m_Expression, m_PassOpt);
+	ast_t *resolved = resolve_nominal(frame.m_Expression);
 	if (resolved == nullptr)
 		return false;
-	m_Type.emplace(PonyType::fromDefinition(resolved));
 
 	ast_t *typeargs = ast_childidx(frame.m_Expression, 2);
+	if (ast_id(resolved) == TK_TYPE)
+		return resolveAlias(resolved, typeargs);
+
+	m_Type.emplace(PonyType::fromDefinition(resolved));
 	if (ast_id(typeargs) == TK_TYPEARGS)
 		m_Type.value().setTypeargs(typeargs);
 
-	m_Frames.emplace(resolved);
+	return true;
+}
+
+bool ExpressionTypeResolver::resolveAlias(ast_t *alias, ast_t *typeargs) {
+	// the aliased type is what members are looked up in, eg. (A | B) only has the members both share
+	PonyType context = PonyType::fromDefinition(alias);
+	if (typeargs != nullptr && ast_id(typeargs) == TK_TYPEARGS)
+		context.setTypeargs(typeargs);
+
+	m_Frames.emplace(ast_child(ast_childidx(alias, TYPE_PROVIDES)), context);
+	stats_count(stats_counter_t::resolver_frames);
 	return true;
 }
 
@@ -301,12 +252,8 @@ bool ExpressionTypeResolver::resolveQualify(type_resolve_frame_t &frame) {
 	AST_GET_CHILDREN(frame.m_Expression, left, qualification);
 	pony_assert(ast_id(qualification) == TK_TYPEARGS);
 
-	auto leftResolve = ExpressionTypeResolver(left, m_PassOpt).resolve();
-	if (!leftResolve)
-		return false;
-
-	leftResolve.value().setTypeargs(qualification);
-	m_Type.emplace(leftResolve.value());
+	push(frame.m_Expression, frame, resolve_step_t::qualify);
+	push(left, frame);
 	return true;
 }
 
@@ -315,13 +262,13 @@ bool ExpressionTypeResolver::resolveAssign(type_resolve_frame_t &frame) {
 	ast_t *assignee = ast_child(frame.m_Expression);
 	ast_t *nominal = ast_first_child_of_type(assignee, TK_NOMINAL);
 	if (nominal != nullptr) {
-		m_Frames.emplace(nominal);
+		push(nominal, frame);
 		return true;
 	}
 
 	// try resolving type by assigned expression
 	ast_t *right = ast_childidx(frame.m_Expression, 1);
-	m_Frames.emplace(right);
+	push(right, frame);
 	return true;
 }
 
@@ -333,47 +280,80 @@ bool ExpressionTypeResolver::resolveMemberAccess(type_resolve_frame_t &frame) {
 
 	pony_assert(ast_id(right) == TK_ID);
 
-	std::optional<PonyType> leftType = ExpressionTypeResolver(left, m_PassOpt).resolve();
+	push(frame.m_Expression, frame, resolve_step_t::member_access);
+	push(left, frame);
+	return true;
+}
 
-	if (!leftType)
+bool ExpressionTypeResolver::resolveComposite(type_resolve_frame_t &frame) {
+	ast_t *first = ast_child(frame.m_Expression);
+	if (first == nullptr)
 		return false;
 
-	bool is_chain = tokenId == TK_CHAIN;
-
-	if (is_chain) {
-		m_Type = leftType;
-		return true;
-	}
-
-	auto members = leftType->getMembers(m_PassOpt);
-
-	for (auto &member : leftType->getMembers(m_PassOpt))
-		if (!member.get_type() || member.get_name() != ast_name(right))
-			continue;
-		else {
-			m_Type = member.get_type();
-			return true;
-		}
-	return false;
+	push(frame.m_Expression, frame, resolve_step_t::compose);
+	m_Frames.top().m_Element = first;
+	push(first, frame);
+	return true;
 }
 
 bool ExpressionTypeResolver::resolveArrow(type_resolve_frame_t &frame){
 	// TODO handle left viewpoint (cap etc)
 	LOG_AST(frame.m_Expression);
-	m_Frames.emplace(ast_childidx(frame.m_Expression, 1));
+	push(ast_childidx(frame.m_Expression, 1), frame);
 	return true;
 }
 
+bool ExpressionTypeResolver::applyStep(type_resolve_frame_t &frame) {
+	switch (frame.m_Step) {
+		case resolve_step_t::qualify:
+			m_Type.value().setTypeargs(ast_childidx(frame.m_Expression, 1));
+			return true;
+
+		case resolve_step_t::member_access: {
+			// chaining evaluates to the receiver
+			if (ast_id(frame.m_Expression) == TK_CHAIN)
+				return true;
+
+			const char *name = ast_name(ast_childidx(frame.m_Expression, 1));
+			for (auto &member : m_Type->getMembers(m_PassOpt))
+				if (!member.get_type() || member.get_name() != name)
+					continue;
+				else {
+					m_Type = member.get_type();
+					return true;
+				}
+			return false;
+		}
+
+		case resolve_step_t::compose:
+			frame.m_Elements.push_back(*m_Type);
+			frame.m_Element = ast_sibling(frame.m_Element);
+			if (frame.m_Element != nullptr) {
+				m_Type.reset();
+				push(frame.m_Element, frame);
+				return true;
+			}
+
+			m_Type = PonyType::composite(ast_id(frame.m_Expression), frame.m_Elements);
+			return true;
+
+		default:
+			return true;
+	}
+}
+
 bool ExpressionTypeResolver::resolveExpression(type_resolve_frame_t &frame) {
 	switch (ast_id(frame.m_Expression)) {
 		case TK_CLASS:
 		case TK_STRUCT:
 		case TK_PRIMITIVE:
 		case TK_ACTOR:
-		case TK_TYPE:
 		case TK_INTERFACE:
+		case TK_TRAIT:
 			m_Type.emplace(PonyType::fromDefinition(frame.m_Expression));
 			return true;
+		case TK_TYPE:
+			return resolveAlias(frame.m_Expression, nullptr);
 
 		case TK_STRING:
 		case TK_FLOAT:
@@ -381,14 +361,14 @@ bool ExpressionTypeResolver::resolveExpression(type_resolve_frame_t &frame) {
 		case TK_INT:
 			return resolveLiteral(frame);
 		case TK_LITERAL:
-			m_Frames.emplace(ast_type(frame.m_Expression));
+			push(ast_type(frame.m_Expression), frame);
 			return true;
 
 		case TK_TYPEPARAMREF: {
-			if (!m_ContextType)
+			if (!frame.m_Context)
 				return false;
-			std::string typeparamName = ast_name(ast_child(frame.m_Expression));
-			m_Type = m_ContextType->getTypearg(typeparamName, m_PassOpt);
+			m_Type = frame.m_Context->getTypearg(ast_name(ast_child(frame.m_Expression)), m_PassOpt);
+			return m_Type.has_value();
 		}
 		case TK_REFERENCE:
 		case TK_PACKAGEREF:
@@ -404,7 +384,6 @@ bool ExpressionTypeResolver::resolveExpression(type_resolve_frame_t &frame) {
 		case TK_VARREF:
 		case TK_LETREF:
 		case TK_PARAMREF:
-		case TK_DONTCAREREF:
 			return resolveReference(frame);
 		case TK_VAR:
 		case TK_LET:
@@ -415,25 +394,31 @@ bool ExpressionTypeResolver::resolveExpression(type_resolve_frame_t &frame) {
 		case TK_MATCH_CAPTURE: {
 			ast_t *nominal = ast_childidx(frame.m_Expression, 1);
 			if (ast_id(nominal) == TK_NOMINAL) {
-				m_Frames.emplace(nominal);
+				push(nominal, frame);
 				return true;
 			}
 
 			ast_t *parent = ast_parent(frame.m_Expression);
 			if (ast_id(parent) == TK_ASSIGN) {
-				m_Frames.emplace(ast_parent(frame.m_Expression));
+				push(parent, frame);
 				return true;
 			}
 
 			return false;
 		}
 		case TK_CALL:
-			m_Frames.emplace(ast_child(frame.m_Expression));
+			push(ast_child(frame.m_Expression), frame);
 			return true;
 		case TK_FUN:
 		case TK_BE:
-			LOG_AST(frame.m_Expression);
-			m_Frames.emplace(ast_childidx(frame.m_Expression, 4));
+		case TK_NEW:
+			push(ast_childidx(frame.m_Expression, 4), frame);
+			return true;
+		case TK_SEQ:
+		case TK_RECOVER:
+		case TK_CONSUME:
+			// the value of a sequence is its last expression
+			push(ast_childlast(frame.m_Expression), frame);
 			return true;
 		case TK_ASSIGN:
 			return resolveAssign(frame);
@@ -447,6 +432,10 @@ bool ExpressionTypeResolver::resolveExpression(type_resolve_frame_t &frame) {
 			return resolveMemberAccess(frame);
 		case TK_ARROW:
 			return resolveArrow(frame);
+		case TK_UNIONTYPE:
+		case TK_ISECTTYPE:
+		case TK_TUPLETYPE:
+			return resolveComposite(frame);
 		default:
 			LOG("[ExpressionTypeResolver] No handler for %s!", token_id_desc(ast_id(frame.m_Expression)));
 			LOG_AST(frame.m_Expression);
@@ -456,7 +445,10 @@ bool ExpressionTypeResolver::resolveExpression(type_resolve_frame_t &frame) {
 
 type_resolve_frame_t::type_resolve_frame_t(
 		ast_t *expression,
+		std::optional<PonyType> context,
+		resolve_step_t step,
 		pony_refcap_t viewpoint_cap)
 		: m_Expression(expression),
+		  m_Context(std::move(context)),
+		  m_Step(step),
 		  m_ViewpointCap(viewpoint_cap) {}
-
@@ -2,13 +2,23 @@
 #include "ExpressionTypeResolver.hpp"
 #include "ast_transformations.hpp"
 #include "logging.hpp"
+#include "stats.hpp"
 
 #include <algorithm>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 
 
-PonyType::PonyType(ast_t *definition) {
+static_assert(std::is_trivially_copyable<PonyType>::value, "PonyType is passed around by value");
+
+PonyType::PonyType(ast_t *definition) : m_Def(definition) {
 	pony_assert(definition != nullptr);
 	token_id valid_tokens[] = {TK_CLASS, TK_ACTOR, TK_STRUCT, TK_INTERFACE, TK_TRAIT, TK_PRIMITIVE, TK_TYPE};
 	bool is_valid_tokentype = false;
@@ -16,43 +26,69 @@ PonyType::PonyType(ast_t *definition) {
 		is_valid_tokentype |= ast_id(definition) == a;
 	}
 	pony_assert(is_valid_tokentype);
+}
 
-	AST_GET_CHILDREN(definition, id, type_params, cap, provides, members, c_api, docstring);
+const char *PonyType::name() const {
+	if (m_Composite != nullptr)
+		return m_Composite->name;
+	return ast_name(ast_child(m_Def));
+}
 
-	m_Def = definition;
-	m_Name = ast_name(id);
+const char *PonyType::docstring() const {
+	if (m_Composite != nullptr)
+		return "";
+	ast_t *docstring = ast_childidx(m_Def, 6);
+	return ast_id(docstring) == TK_STRING ? ast_name(docstring) : "";
+}
 
-	if (ast_id(docstring) == TK_STRING)
-		m_DocString = ast_name(docstring);
+PonyType PonyType::fromDefinition(ast_t *definition) {
+	return PonyType(definition);
+}
 
-	// get typeparams
-	for (size_t i = 0; i < ast_childcount(type_params); i++) {
-		ast_t *type_param = ast_childidx(type_params, i);
-		m_TypeParams.push_back(type_param);
-	}
+typedef tuple<ast_t *, ast_t *, const composite_type_t *> type_identity_t;
+typedef pair<int, vector<type_identity_t>> composite_key_t;
+
+// composites are interned, so a composite pointer identifies a type just like a definition does
+static map<composite_key_t, unique_ptr<composite_type_t>> composite_types;
 
-	// get provides
-	for (size_t i = 0; i < ast_childcount(provides); i++) {
-		// could be nominal or typeparamref
-		ast_t *provided = ast_childidx(provides, i);
-		m_Provides.push_back(provided);
+static const char *composite_name(token_id kind, const vector<PonyType> &elements) {
+	const char *separator = kind == TK_UNIONTYPE ? " | " : kind == TK_ISECTTYPE ? " & " : ", ";
+
+	string name = "(";
+	for (size_t i = 0; i < elements.size(); i++) {
+		if (i > 0)
+			name += separator;
+		name += elements[i].name();
 	}
+	name += ")";
+	return stringtab(name.c_str());
 }
 
-PonyType PonyType::fromDefinition(ast_t *definition) {
-	return PonyType(definition);
+PonyType PonyType::composite(token_id kind, const vector<PonyType> &elements) {
+	pony_assert(kind == TK_UNIONTYPE || kind == TK_ISECTTYPE || kind == TK_TUPLETYPE);
+
+	composite_key_t key;
+	key.first = kind;
+	key.second.reserve(elements.size());
+	for (auto &element : elements)
+		key.second.emplace_back(element.definition(), element.typeargs(), element.composite());
+
+	auto &composite = composite_types[key];
+	if (!composite)
+		composite.reset(new composite_type_t{kind, elements, composite_name(kind, elements)});
+
+	return PonyType(composite.get());
 }
 
 void PonyType::setTypeargs(ast_t *typeargs) {
+	// typeargs are resolved lazily, once per instantiation, see substitution()
 	m_TypeArgs = typeargs;
-	// TODO where to resolve typeargs types
 }
 
-static void push_nominal_descendents(ast_t *ast, set<ast_t *> &vec) {
-	for (size_t i = 0; i < ast_childcount(ast); i++) {
-		ast_t *child = ast_childidx(ast, i);
+static void push_nominal_descendents(ast_t *ast, vector<ast_t *> &vec) {
+	for (ast_t *child = ast_child(ast); child != nullptr; child = ast_sibling(child)) {
 		if (ast_id(child) == TK_NOMINAL)
-			vec.insert(child);
+			vec.push_back(child);
 		else {
 			if (ast_id(child) != TK_TYPEARGS)
 				push_nominal_descendents(child, vec);
@@ -60,87 +96,280 @@ static void push_nominal_descendents(ast_t *ast, set<ast_t *> &vec) {
 	}
 }
 
+struct member_collection_t {
+	// in source order, own members before provided ones
+	vector<ast_t *> members;
+	// member names are stringtab entries, so pointers identify them
+	unordered_set<const char *> names;
+	unordered_set<ast_t *> providers;
+	// a resolve ran out of budget, so types or provided members may be missing
+	bool partial = false;
+};
+
 static void
-collect_provided_members(ast_t *provider, set<ast_t *> &member_set, pass_opt_t *pass_opt) {
-	ast_t *members = ast_childidx(provider, 4);
-	for (size_t i = 0; i < ast_childcount(members); i++) {
-		ast_t *member = ast_childidx(members, i);
+collect_provided_members(ast_t *provider, member_collection_t &collection, pass_opt_t *pass_opt) {
+	if (!collection.providers.insert(provider).second)
+		return;
 
-		// check if same name is already contained, so we dont get duplicates from overriding
+	ast_t *members = ast_childidx(provider, 4);
+	for (ast_t *member = ast_child(members); member != nullptr; member = ast_sibling(member)) {
+		// skip names that are already contained, so we dont get duplicates from overriding
 		// TODO keep track of overrides somewhare for more indepth inspections
-		bool is_first_member_of_name = std::none_of(member_set.begin(), member_set.end(),
-		                                            [member](ast_t *m) {
-			                                            return ast_name(ast_first_child_of_type(m, TK_ID)) ==
-			                                                   ast_name(ast_first_child_of_type(member, TK_ID));
-		                                            });
-		if (is_first_member_of_name)
-			member_set.insert(ast_childidx(members, i));
+		ast_t *id = ast_first_child_of_type(member, TK_ID);
+		if (id != nullptr && collection.names.insert(ast_name(id)).second)
+			collection.members.push_back(member);
 	}
 
 	ast_t *provides = ast_childidx(provider, 3);
-	set<ast_t *> provided_nominals;
+	vector<ast_t *> provided_nominals;
 	push_nominal_descendents(provides, provided_nominals);
 
 	for (auto &nominal : provided_nominals) {
-		ast_t *resolved = resolve(nominal, pass_opt);
-		if (resolved == nullptr)
+		ExpressionTypeResolver resolver(nominal, pass_opt);
+		auto provided = resolver.resolve();
+		collection.partial |= resolver.isPartial();
+		if (!provided)
 			continue;
 
-		collect_provided_members(resolved, member_set, pass_opt);
+		collect_provided_members(provided->definition(), collection, pass_opt);
 	}
 }
 
 
-vector<PonyMember> PonyType::getMembers(pass_opt_t *pass_opt) const {
-	std::set<ast_t *> members_defs;
-	collect_provided_members(m_Def, members_defs, pass_opt);
+static SymbolKind symbol_kind_of(token_id id) {
+	// SymbolKind_Parse needs a std::string, so only parse each token kind once
+	static unordered_map<int, SymbolKind> kinds;
+	auto it = kinds.find(id);
+	if (it != kinds.end())
+		return it->second;
+
+	SymbolKind kind;
+	if (!SymbolKind_Parse(token_id_desc(id), &kind)) {
+		kind = unknown;
+		LOG("could not parse symbolkind %s", token_id_desc(id));
+	}
+	return kinds.emplace(id, kind).first->second;
+}
+
+static vector<PonyMember> collect_members(const PonyType &type, pass_opt_t *pass_opt, bool &partial) {
+	member_collection_t collection;
+	collect_provided_members(type.definition(), collection, pass_opt);
+	partial = collection.partial;
 
-	std::vector<PonyMember> members;
+	std::vector<PonyMember> members(collection.members.size());
 
-	for (auto &def :members_defs) {
+	for (size_t i = 0; i < members.size(); i++) {
+		ast_t *def = collection.members[i];
+		PonyMember &member = members[i];
 
-		PonyMember member;
 		member.set_name(ast_name(ast_first_child_of_type(def, TK_ID)));
 		member.set_definition(def);
-
-		if (!SymbolKind_Parse(token_id_desc(ast_id(def)), &member.m_Kind)) {
-			member.m_Kind = unknown;
-			LOG("could not parse symbolkind %s", token_id_desc(ast_id(def)));
-		}
+		member.m_Kind = symbol_kind_of(ast_id(def));
 
 		ast_t *memberTypeNode = ast_childidx(def, 4);
 
 		if (memberTypeNode != nullptr) {
 			auto resolver = ExpressionTypeResolver(memberTypeNode, pass_opt);
-			member.set_type(resolver.resolve(*this));
+			member.set_type(resolver.resolve(type));
+			partial |= resolver.isPartial();
 		}
 
 		ast_t *doc_node = ast_first_child_of_type(def, TK_STRING);
 		if (doc_node != nullptr)
 			member.set_docstring(ast_name(doc_node));
+	}
+
+	stats_count(stats_counter_t::members_collected, members.size());
+	return members;
+}
+
+static map<pair<ast_t *, ast_t *>, vector<PonyMember>> member_tables;
+
+static vector<PonyMember> collect_tuple_members(const composite_type_t &composite) {
+	vector<PonyMember> members(composite.elements.size());
+	for (size_t i = 0; i < members.size(); i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "_%zu", i + 1);
+
+		members[i].set_name(stringtab(name));
+		members[i].set_type(composite.elements[i]);
+		members[i].m_Kind = symbol_kind_of(TK_LET);
+	}
+	return members;
+}
+
+struct member_entry_t {
+	const char *name;
+	size_t element;
+	size_t index;
+};
+
+/*
+ * A union only has the members all of its elements have, an intersection has those any of its elements has.
+ * All member tables are merged into one array sorted by interned name, so every name forms one run
+ * holding at most one entry per element.
+ */
+static vector<PonyMember> collect_composite_members(const composite_type_t &composite, pass_opt_t *pass_opt, bool &partial) {
+	partial = false;
+	if (composite.kind == TK_TUPLETYPE)
+		return collect_tuple_members(composite);
+
+	vector<const vector<PonyMember> *> tables;
+	vector<member_entry_t> entries;
+	for (size_t element = 0; element < composite.elements.size(); element++) {
+		bool element_partial = false;
+		const vector<PonyMember> &table = composite.elements[element].getMembers(pass_opt, &element_partial);
+		partial |= element_partial;
+		tables.push_back(&table);
+		for (size_t index = 0; index < table.size(); index++)
+			entries.push_back(member_entry_t{table[index].get_name(), element, index});
+	}
+
+	auto by_name = [](const member_entry_t &a, const member_entry_t &b) {
+		return std::less<const char *>()(a.name, b.name) || (a.name == b.name && a.element < b.element);
+	};
+	sort(entries.begin(), entries.end(), by_name);
+
+	vector<member_entry_t> selected;
+	for (size_t run = 0; run < entries.size();) {
+		size_t end = run;
+		while (end < entries.size() && entries[end].name == entries[run].name)
+			end++;
 
-		members.push_back(member);
+		if (composite.kind == TK_ISECTTYPE || end - run == composite.elements.size())
+			selected.push_back(entries[run]);
+		run = end;
 	}
 
+	// back to the order of the member tables
+	sort(selected.begin(), selected.end(), [](const member_entry_t &a, const member_entry_t &b) {
+		return a.element < b.element || (a.element == b.element && a.index < b.index);
+	});
+
+	vector<PonyMember> members;
+	members.reserve(selected.size());
+	for (auto &entry : selected)
+		members.push_back((*tables[entry.element])[entry.index]);
+
+	stats_count(stats_counter_t::members_collected, members.size());
 	return members;
 }
 
-std::optional<PonyType> PonyType::getTypearg(std::string &name, pass_opt_t *pass_opt) {
-	for (size_t i = 0; i < m_TypeParams.size(); i++) {
-		ast_t *arg = ast_childidx(m_TypeArgs, i);
-		if (name != ast_name(ast_child(m_TypeParams[i])))
-			continue;
+static map<const composite_type_t *, vector<PonyMember>> composite_member_tables;
+
+// tables built while the resolve budget ran out, never looked up again but referenced by their callers
+static list<vector<PonyMember>> partial_member_tables;
 
-		return ExpressionTypeResolver(arg, pass_opt).resolve(*this);
+template<typename Key>
+static const vector<PonyMember> &
+keep_members(map<Key, vector<PonyMember>> &tables, const Key &key, vector<PonyMember> members, bool built_partial,
+             bool *partial) {
+	if (partial != nullptr)
+		*partial = built_partial;
+
+	if (built_partial) {
+		partial_member_tables.push_back(std::move(members));
+		return partial_member_tables.back();
+	}
+	return tables.emplace(key, std::move(members)).first->second;
+}
+
+const vector<PonyMember> &PonyType::getMembers(pass_opt_t *pass_opt, bool *partial) const {
+	if (partial != nullptr)
+		*partial = false;
+
+	bool built_partial = false;
+	if (m_Composite != nullptr) {
+		auto it = composite_member_tables.find(m_Composite);
+		if (it != composite_member_tables.end())
+			return it->second;
+
+		auto members = collect_composite_members(*m_Composite, pass_opt, built_partial);
+		return keep_members(composite_member_tables, m_Composite, std::move(members), built_partial, partial);
 	}
-	return optional<PonyType>();
+
+	auto key = make_pair(m_Def, m_TypeArgs);
+	auto it = member_tables.find(key);
+	if (it != member_tables.end())
+		return it->second;
+
+	auto members = collect_members(*this, pass_opt, built_partial);
+	return keep_members(member_tables, key, std::move(members), built_partial, partial);
+}
+
+void PonyType::dropPartialMembers() {
+	partial_member_tables.clear();
+}
+
+typedef pair<ast_t *, ast_t *> instantiation_key_t;
+
+/**
+ * @brief typeparam names (stringtab entries) mapped to the types of the typeargs they were instantiated with
+ */
+struct substitution_t {
+	vector<pair<const char *, optional<PonyType>>> bindings;
+};
+
+static map<instantiation_key_t, substitution_t> substitutions;
+
+void PonyType::clearMemberCache() {
+	member_tables.clear();
+	composite_member_tables.clear();
+	partial_member_tables.clear();
+	substitutions.clear();
+}
+
+/**
+ * @param partial set if a typearg ran out of resolve budget, the caller has to drop the substitution then
+ */
+static const substitution_t &substitution(const PonyType &type, pass_opt_t *pass_opt, bool &partial) {
+	instantiation_key_t key(type.definition(), type.typeargs());
+	auto it = substitutions.find(key);
+	if (it != substitutions.end())
+		return it->second;
+
+	// map nodes are stable, so the entry survives nested instantiations being added.
+	// resolving a typearg can lead back here, which then sees the bindings still unresolved
+	substitution_t &subst = substitutions[key];
+
+	ast_t *param = ast_child(ast_childidx(type.definition(), TYPE_PARAMS));
+	ast_t *arg = ast_child(type.typeargs());
+	for (; param != nullptr && arg != nullptr; param = ast_sibling(param), arg = ast_sibling(arg))
+		subst.bindings.emplace_back(ast_name(ast_child(param)), std::nullopt);
+
+	arg = ast_child(type.typeargs());
+	for (auto &binding : subst.bindings) {
+		ExpressionTypeResolver resolver(arg, pass_opt);
+		binding.second = resolver.resolve(type);
+		partial |= resolver.isPartial();
+		arg = ast_sibling(arg);
+	}
+
+	return subst;
+}
+
+std::optional<PonyType> PonyType::getTypearg(const char *name, pass_opt_t *pass_opt) const {
+	if (m_TypeArgs == nullptr)
+		return optional<PonyType>();
+
+	bool partial = false;
+	const substitution_t &subst = substitution(*this, pass_opt, partial);
+
+	optional<PonyType> bound;
+	for (auto &binding : subst.bindings)
+		if (binding.first == name)
+			bound = binding.second;
+
+	if (partial)
+		substitutions.erase(instantiation_key_t(m_Def, m_TypeArgs));
+	return bound;
 }
 
-void PonyMember::set_name(const string &m_Name) {
+void PonyMember::set_name(const char *m_Name) {
 	PonyMember::m_Name = m_Name;
 }
 
-void PonyMember::set_docstring(const string &m_Docstring) {
+void PonyMember::set_docstring(const char *m_Docstring) {
 	PonyMember::m_Docstring = m_Docstring;
 }
 
@@ -152,11 +381,11 @@ void PonyMember::set_capability(pony_refcap_t m_Capability) {
 	PonyMember::m_Capability = m_Capability;
 }
 
-const string &PonyMember::get_name() const {
+const char *PonyMember::get_name() const {
 	return m_Name;
 }
 
-const string &PonyMember::get_docstring() const {
+const char *PonyMember::get_docstring() const {
 	return m_Docstring;
 }
 
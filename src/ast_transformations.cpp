@@ -1,4 +1,5 @@
 #include "ast_transformations.hpp"
+#include "source_index.hpp"
 #include <algorithm>
 #include <cstring>
 
@@ -14,70 +15,125 @@ pass_opt_data_guard::~pass_opt_data_guard() {
 	options->data = old_data;
 }
 
-struct seq_data {
-	const char *file = nullptr;
-	vector<ast_t *> nodes;
-};
+ast_t *find_identifier_at(ast_t *tree, pass_opt_t *, caret_t const &position, string const &sourcefile) {
+	ast_t *module = find_module(tree, stringtab(sourcefile.c_str()));
+	if (module == nullptr)
+		return nullptr;
 
+	return SourceIndex::forModule(module).identifierAt(position);
+}
 
-static ast_result_t visit_seq_post(ast_t **pAst, pass_opt_t *opt) {
-	pony_assert(pAst != nullptr);
-	pony_assert(*pAst != nullptr);
-
-	//if (ast_id(*pAst) >= TK_PROGRAM || ast_line(*pAst) != 6)
-
-	auto data = static_cast<seq_data *>(opt->data);
-	if (ast_source(*pAst) != nullptr && ast_source(*pAst)->file == data->file)
-		data->nodes.push_back(*pAst);
+ast_t *ast_first_child_of_type(ast_t *parent, token_id id) {
+	for (ast_t *ast = ast_child(parent); ast != nullptr; ast = ast_sibling(ast))
+		if (ast_id(ast) == id)
+			return ast;
+	return nullptr;
+}
 
-	return AST_OK;
+ast_t *find_module(ast_t *package, const char *file) {
+	for (ast_t *module = ast_child(package); module != nullptr; module = ast_sibling(module)) {
+		source_t *source = ast_source(module);
+		if (source != nullptr && source->file == file)
+			return module;
+	}
+	return nullptr;
 }
 
-vector<ast_t *> tree_to_sourceloc_ordered_sequence(ast_t *tree, pass_opt_t *opt, const char *file) {
-	seq_data data;
-	data.file = stringtab(file);
-	pass_opt_data_guard data_guard(opt, &data);
+/**
+ * @return the child with the greatest starting line not after line,
+ * children are not guaranteed to be in source order after sugar
+ */
+static ast_t *last_child_starting_before(ast_t *parent, size_t line) {
+	ast_t *found = nullptr;
+	for (ast_t *child = ast_child(parent); child != nullptr; child = ast_sibling(child)) {
+		if (ast_line(child) <= line && (found == nullptr || ast_line(child) > ast_line(found)))
+			found = child;
+	}
+	return found;
+}
 
-	ast_visit(&tree, nullptr, visit_seq_post, opt, PASS_ALL);
+ast_t *enclosing_declaration(ast_t *module, size_t line) {
+	ast_t *entity = last_child_starting_before(module, line);
+	if (entity == nullptr)
+		return module;
+
+	switch (ast_id(entity)) {
+		case TK_CLASS:
+		case TK_ACTOR:
+		case TK_STRUCT:
+		case TK_PRIMITIVE:
+		case TK_TRAIT:
+		case TK_INTERFACE:
+			break;
+		default:
+			return entity;
+	}
 
-	sort(data.nodes.begin(), data.nodes.end(),
-	     [](ast_t *a, ast_t *b) {
-		     if (ast_line(a) < ast_line(b))
-			     return true;
-		     if (ast_id(a) >= TK_PROGRAM)
-			     return false;
-		     return ast_pos(a) < ast_pos(b);
-	     });
+	// sugar adds members positioned at the entity, so its own line always maps to the entity
+	if (ast_line(entity) == line)
+		return entity;
 
-	return data.nodes;
+	ast_t *member = last_child_starting_before(ast_childidx(entity, 4), line);
+	return member != nullptr ? member : entity;
 }
 
-ast_t *find_identifier_at(ast_t *tree, pass_opt_t *opt, caret_t const &position, string const &sourcefile) {
-	auto sequence = tree_to_sourceloc_ordered_sequence(tree, opt, stringtab(sourcefile.c_str()));
-
-	for (auto &node : sequence) {
-		if (ast_id(node) != TK_ID)
-			continue;
+/**
+ * @return last line of a method's signature, as far as positions of its parameters and result tell
+ */
+static size_t signature_end_line(ast_t *method) {
+	AST_GET_CHILDREN(method, cap, id, typeparams, params, result);
+	size_t end = ast_line(method);
 
-		source_t *source = ast_source(node);
+	for (ast_t *param = ast_child(params); param != nullptr; param = ast_sibling(param))
+		end = max(end, ast_line(param));
 
-		if (source == nullptr || source->file == nullptr || strcmp(source->file, sourcefile.c_str()) != 0)
-			continue;
-
-		caret_t node_loc(ast_line(node), ast_pos(node));
+	if (ast_id(result) != TK_NONE)
+		end = max(end, ast_line(result));
+	return end;
+}
 
-		if (position.in_range(node_loc, ast_name_len(node))) {
+ast_t *enclosing_statement(ast_t *module, size_t line) {
+	ast_t *node = enclosing_declaration(module, line);
+
+	switch (ast_id(node)) {
+		case TK_NEW:
+		case TK_FUN:
+		case TK_BE:
+			if (line <= signature_end_line(node))
+				return node;
+			break;
+		case TK_FVAR:
+		case TK_FLET:
+		case TK_EMBED:
+			// sugar moved the initializer into the constructors, walk them along with the field
+			return ast_parent(ast_parent(node));
+		default:
 			return node;
-		}
 	}
 
-	return nullptr;
-}
+	ast_t *seq = ast_childidx(node, 6);
+
+	// a statement starts after the previous one ended, so it can only contain line
+	// if it doesn't start after line and the next one doesn't start before it
+	while (ast_id(seq) == TK_SEQ) {
+		ast_t *candidate = nullptr;
+		for (ast_t *statement = ast_child(seq); statement != nullptr; statement = ast_sibling(statement)) {
+			ast_t *next = ast_sibling(statement);
+			bool before = next != nullptr && ast_line(next) < line;
+			bool after = ast_line(statement) > line;
+
+			if (before || after)
+				continue;
+			if (candidate != nullptr)
+				return seq;
+			candidate = statement;
+		}
 
-ast_t *ast_first_child_of_type(ast_t *parent, token_id id) {
-	for (ast_t *ast = ast_child(parent); ast != nullptr; ast = ast_sibling(ast))
-		if (ast_id(ast) == id)
-			return ast;
-	return nullptr;
-}
+		if (candidate == nullptr)
+			return seq;
 
+		node = seq = candidate;
+	}
+
+	return node;
+}
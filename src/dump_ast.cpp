@@ -1,6 +1,18 @@
 #include "dump_ast.hpp"
 
-void dump_ast(cli_opts_t options){
+#include <cstdio>
+#include <cstdlib>
+
+void dump_ast(cli_opts_t options, std::ostream &out) {
 	ast_t *package_ast = ast_child(options.program);
-	ast_print(package_ast, 40);
+
+	// ast_print only writes to stdout, render into memory so serve can frame the output
+	char *buffer = nullptr;
+	size_t size = 0;
+	FILE *stream = open_memstream(&buffer, &size);
+	ast_fprint(stream, package_ast, 40);
+	fclose(stream);
+
+	out.write(buffer, size);
+	free(buffer);
 }
@@ -4,43 +4,239 @@
 #include "ast_transformations.hpp"
 #include "logging.hpp"
 #include "ExpressionTypeResolver.hpp"
+#include "snapshot.hpp"
+#include "framing.hpp"
+#include "stats.hpp"
 
+#include <intellisense.pb.h>
+
+#include <chrono>
+#include <cctype>
 #include <cstring>
 #include <functional>
+#include <queue>
+#include <unordered_set>
 
 
 using namespace std;
 
-void _dump_scope(cli_opts_t &options);
+void _dump_scope(cli_opts_t &options, std::ostream &out);
 
-void dump_scope(cli_opts_t &options) {
-	_dump_scope(options);
+void dump_scope(cli_opts_t &options, std::ostream &out) {
+	_dump_scope(options, out);
 }
 
+/**
+ * @brief collects symbols into one Scope message, or writes each of them as
+ * soon as the next one is requested when streaming
+ */
+class symbol_sink_t {
+private:
+	std::ostream &m_Out;
+	bool m_Stream;
+	Scope m_Scope;
+	ScopeStreamRecord m_Record;
+	uint32_t m_Count = 0;
+	uint64_t m_BytesWritten = 0;
+	chrono::steady_clock::time_point m_Start = chrono::steady_clock::now();
+
+	void flushRecord() {
+		if (!m_Record.has_symbol())
+			return;
+
+		stats_timer_t timer(stats_phase_t::serialization);
+		std::string record = m_Record.SerializeAsString();
+		write_delimited(m_Out, record);
+		m_Out.flush();
+		m_BytesWritten += record.size();
+		stats_count(stats_counter_t::bytes_serialized, record.size());
+		m_Record.Clear();
+	}
+
+public:
+	symbol_sink_t(std::ostream &out, bool stream) : m_Out(out), m_Stream(stream) {}
+
+	Symbol *add() {
+		m_Count++;
+		if (!m_Stream)
+			return m_Scope.add_symbols();
+
+		flushRecord();
+		return m_Record.mutable_symbol();
+	}
+
+	uint32_t count() const { return m_Count; }
+
+	void finish() {
+		if (!m_Stream) {
+			stats_timer_t timer(stats_phase_t::serialization);
+			m_Scope.SerializeToOstream(&m_Out);
+			stats_count(stats_counter_t::bytes_serialized, m_Scope.ByteSizeLong());
+			return;
+		}
+
+		flushRecord();
+		stats_timer_t timer(stats_phase_t::serialization);
+		StreamTrailer *trailer = m_Record.mutable_trailer();
+		trailer->set_num_symbols(m_Count);
+		trailer->set_bytes_written(m_BytesWritten);
+		trailer->set_elapsed_us((uint64_t) chrono::duration_cast<chrono::microseconds>(
+				chrono::steady_clock::now() - m_Start).count());
+		write_delimited(m_Out, m_Record);
+		m_Out.flush();
+		stats_count(stats_counter_t::bytes_serialized, m_Record.ByteSizeLong());
+		m_Record.Clear();
+	}
+};
+
 struct scope_pass_data_t {
 	cli_opts_t &options;
-	Scope scope_msg;
+	symbol_sink_t symbols;
 
-	explicit scope_pass_data_t(cli_opts_t &options) : options(options) {}
+	scope_pass_data_t(cli_opts_t &options, std::ostream &out) : options(options), symbols(out, options.stream) {}
 };
 
 static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt);
 
-void _dump_scope(cli_opts_t &options) {
-	ast_t *ast = ast_child(options.program);
-	pass_opt_t *opt = &options.pass_opt;
-	scope_pass_data_t scope_pass_data(options);
-	scope_pass_data.scope_msg = Scope();
+// closeness of a completion, lower ranks are listed first
+enum class scope_rank_t {
+	local = 0,
+	field = 1,
+	package = 2,
+	builtin = 3
+};
 
+struct ranked_symbol_t {
+	scope_rank_t rank;
+	size_t distance;
+	symbol_t *symbol;
+
+	bool operator<(const ranked_symbol_t &other) const {
+		if (rank != other.rank)
+			return rank < other.rank;
+		if (distance != other.distance)
+			return distance < other.distance;
+		return strcmp(symbol->name, other.symbol->name) < 0;
+	}
+};
+
+static scope_rank_t rank_of_scope(ast_t *scope_owner) {
+	switch (ast_id(scope_owner)) {
+		case TK_CLASS:
+		case TK_ACTOR:
+		case TK_STRUCT:
+		case TK_PRIMITIVE:
+		case TK_TRAIT:
+		case TK_INTERFACE:
+		case TK_TYPE:
+			return scope_rank_t::field;
+		case TK_MODULE:
+		case TK_PACKAGE:
+			return scope_rank_t::package;
+		default:
+			return scope_rank_t::local;
+	}
+}
+
+static void add_scope_symbol(symbol_sink_t &symbols, symbol_t *symbol) {
+	Symbol *symbol_msg = symbols.add();
+	symbol_msg->set_name(symbol->name);
+	{
+		SymbolKind kind_enum;
+		if (SymbolKind_Parse(ast_print_type(symbol->def), &kind_enum))
+			symbol_msg->set_kind(kind_enum);
+	}
 
 	{
+		SourceLocation *symbol_location = symbol_msg->mutable_definition_location();
+		source_t *source = ast_source(symbol->def);
+		if (source != nullptr)
+			symbol_location->set_file(source->file);
+		symbol_location->set_line((uint32_t) ast_line(symbol->def));
+		symbol_location->set_column((uint32_t) ast_pos(symbol->def));
+	}
+
+	{
+		ast_t *docstring = ast_childlast(symbol->def);
+		if (ast_id(docstring) == TK_STRING)
+			symbol_msg->set_docstring(ast_name(docstring));
+	}
+}
+
+/**
+ * @return whether a member named name passes the prefix filter and the result limit
+ */
+static bool accept_member(const cli_opts_t &options, const symbol_sink_t &symbols, const char *name) {
+	// private members start with _, tuple elements are named _1, _2, ...
+	if (name[0] == '_' && !isdigit((unsigned char) name[1]))
+		return false;
+	if (options.limit > 0 && symbols.count() >= options.limit)
+		return false;
+	return strncmp(name, options.prefix.c_str(), options.prefix.size()) == 0;
+}
+
+/**
+ * @brief emits the members of a non generic builtin type straight from the snapshot
+ * @return false if the snapshot does not cover type
+ */
+static bool add_snapshot_members(const PonyType &type, cli_opts_t &options, symbol_sink_t &symbols) {
+	if (!is_builtin_definition(type.definition()))
+		return false;
+
+	const BuiltinSnapshot *snapshot = builtin_snapshot(options, ast_nearest(type.definition(), TK_PACKAGE));
+	if (snapshot == nullptr)
+		return false;
+
+	const snapshot_type_t *snapshot_type = snapshot->findType(type.name());
+	if (snapshot_type == nullptr || snapshot_type->typeparam_count > 0)
+		return false;
+
+	const snapshot_member_t *members = snapshot->members(*snapshot_type);
+	for (uint32_t i = 0; i < snapshot_type->member_count; i++) {
+		const snapshot_member_t &member = members[i];
+		if (!accept_member(options, symbols, snapshot->str(member.name)))
+			continue;
+
+		Symbol *symbol = symbols.add();
+		symbol->set_name(snapshot->str(member.name));
+		symbol->set_docstring(snapshot->str(member.docstring));
+		symbol->set_kind((SymbolKind) member.kind);
+		if (member.type_name != 0) {
+			TypeInfo *typeInfo = symbol->mutable_type();
+			typeInfo->set_name(snapshot->str(member.type_name));
+			typeInfo->set_docstring(snapshot->str(member.type_docstring));
+		}
+
+		const snapshot_param_t *params = snapshot->params(member);
+		for (uint32_t j = 0; j < member.param_count; j++) {
+			auto paramInfo = symbol->add_parameters();
+			paramInfo->set_name(snapshot->str(params[j].name));
+			if (params[j].type_name != 0) {
+				auto paramTypeInfo = paramInfo->mutable_type();
+				paramTypeInfo->set_name(snapshot->str(params[j].type_name));
+				paramTypeInfo->set_docstring(snapshot->str(params[j].type_docstring));
+			}
+		}
+	}
+	return true;
+}
+
+void _dump_scope(cli_opts_t &options, std::ostream &out) {
+	ast_t *module = find_module(ast_child(options.program), stringtab(options.file.c_str()));
+	pass_opt_t *opt = &options.pass_opt;
+	scope_pass_data_t scope_pass_data(options, out);
+
+	if (module != nullptr) {
+		// only the statement around the caret can contain the node scope_pass looks for
+		ast_t *ast = options.line > 0 ? enclosing_statement(module, options.line) : module;
+
 		const auto guard = pass_opt_data_guard(&options.pass_opt, &scope_pass_data);
+		stats_timer_t timer(stats_phase_t::scope_walk);
 		ast_visit(&ast, nullptr, scope_pass, opt, PASS_ALL);
 	}
 
-	std::ostream &msg_stream = std::cout;
-	scope_pass_data.scope_msg.SerializeToOstream(&msg_stream);
-	fprintf(stderr, "[*] Scope Message Stats\nNum Symbols: %i\n", scope_pass_data.scope_msg.symbols_size());
+	scope_pass_data.symbols.finish();
+	fprintf(stderr, "[*] Scope Message Stats\nNum Symbols: %u\n", scope_pass_data.symbols.count());
 
 }
 
@@ -50,6 +246,8 @@ static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt) {
 	if (scope_pass_data == nullptr)
 		return AST_IGNORE;
 
+	stats_count(stats_counter_t::nodes_visited);
+
 	if (ast_source(*pAst) == nullptr || scope_pass_data->options.file != ast_source(*pAst)->file)
 		return AST_OK;
 
@@ -74,12 +272,20 @@ static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt) {
 		ExpressionTypeResolver typeResolver(dot_left, opt);
 		auto resolved_type = typeResolver.resolve();
 		if (resolved_type.has_value()) {
-			for (auto &member : resolved_type->getMembers(opt)) {
+			if (add_snapshot_members(*resolved_type, *options, scope_pass_data->symbols))
+				return AST_OK;
+
+			bool partial = false;
+			const auto &members = resolved_type->getMembers(opt, &partial);
+			if (partial)
+				LOG("type resolution ran out of budget, members may be missing");
+
+			for (auto &member : members) {
 
-				if(member.get_name()[0] == '_')
+				if (!accept_member(*options, scope_pass_data->symbols, member.get_name()))
 					continue;
 
-				Symbol *symbol = scope_pass_data->scope_msg.add_symbols();
+				Symbol *symbol = scope_pass_data->symbols.add();
 				symbol->set_name(member.get_name());
 				symbol->set_docstring(member.get_docstring());
 				symbol->set_kind(member.m_Kind);
@@ -113,6 +319,8 @@ static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt) {
 				}
 			}
 
+		} else if (typeResolver.isPartial()) {
+			LOG("type resolution ran out of budget");
 		} else LOG("NO has value!!");
 		return AST_OK;
 	} // end .,~,.>
@@ -128,6 +336,11 @@ static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt) {
 		} else if (ast_id(ast_parent(*pAst)) == TK_DOT)
 			return AST_OK;
 
+		const string &prefix = options->prefix;
+		priority_queue<ranked_symbol_t> best;
+		unordered_set<const char *> seen_names;
+		size_t distance = 0;
+
 		for (ast_t *current = *pAst; current != nullptr && ast_id(current) != TK_PROGRAM; current = ast_parent(current)) {
 			if (!ast_has_scope(current))
 				continue;
@@ -135,6 +348,9 @@ static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt) {
 			if (scope == nullptr)
 				continue;
 
+			scope_rank_t scope_rank = rank_of_scope(current);
+			distance++;
+
 			size_t iter = HASHMAP_BEGIN;
 			for (;;) {
 				symbol_t *symbol = symtab_next(scope, &iter);
@@ -147,36 +363,35 @@ static ast_result_t scope_pass(ast_t **pAst, pass_opt_t *opt) {
 				if (symbol->name[0] == '$')
 					continue;
 
+				if (strncmp(symbol->name, prefix.c_str(), prefix.size()) != 0)
+					continue;
+
+				// inner scopes are visited first and shadow outer definitions of the same name
+				if (seen_names.count(symbol->name) > 0)
+					continue;
+
 				// do another lookup to make sure we dont get those weird UPPERCASED DUPLICATES
 				if (ast_get(*pAst, symbol->name, nullptr) == nullptr)
 					continue;
 
-				Symbol *symbol_msg = scope_pass_data->scope_msg.add_symbols();
-				symbol_msg->set_name(symbol->name);
-				{
-					SymbolKind kind_enum;
-					if (symbol->name == stringtab("AmbientAuth")) LOG(ast_print_type(symbol->def));
-					if (SymbolKind_Parse(ast_print_type(symbol->def), &kind_enum))
-						symbol_msg->set_kind(kind_enum);
-				}
+				seen_names.insert(symbol->name);
 
-				{
-					SourceLocation *symbol_location = symbol_msg->mutable_definition_location();
-					source_t *source = ast_source(symbol->def);
-					if (source != nullptr)
-						symbol_location->set_file(source->file);
-					symbol_location->set_line((uint32_t) ast_line(symbol->def));
-					symbol_location->set_column((uint32_t) ast_pos(symbol->def));
-				}
-
-				{
-					ast_t *docstring = ast_childlast(symbol->def);
-					if (ast_id(docstring) == TK_STRING)
-						symbol_msg->set_docstring(ast_name(docstring));
-				}
+				scope_rank_t rank = is_builtin_definition(symbol->def) ? scope_rank_t::builtin : scope_rank;
+				best.push(ranked_symbol_t{rank, distance, symbol});
+				if (options->limit > 0 && best.size() > options->limit)
+					best.pop();
 			}
 		}
 
+		// the heap yields the worst candidate first
+		vector<ranked_symbol_t> ranked;
+		ranked.reserve(best.size());
+		for (; !best.empty(); best.pop())
+			ranked.push_back(best.top());
+
+		for (auto it = ranked.rbegin(); it != ranked.rend(); ++it)
+			add_scope_symbol(scope_pass_data->symbols, it->symbol);
+
 		scope_pass_data->options.pass_opt.data = nullptr;
 		return AST_IGNORE;
 	}
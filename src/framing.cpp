@@ -0,0 +1,44 @@
+#include "framing.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+
+using google::protobuf::io::CodedOutputStream;
+
+static bool read_varint32(std::istream &in, uint32_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		int byte = in.get();
+		if (byte == std::char_traits<char>::eof())
+			return false;
+
+		value |= (uint32_t) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool read_delimited(std::istream &in, std::string &record) {
+	uint32_t size;
+	if (!read_varint32(in, size))
+		return false;
+
+	record.resize(size);
+	if (size == 0)
+		return true;
+
+	in.read(&record[0], size);
+	return (size_t) in.gcount() == size;
+}
+
+void write_delimited(std::ostream &out, const std::string &record) {
+	uint8_t header[5]; // a varint32 takes at most 5 bytes
+	uint8_t *end = CodedOutputStream::WriteVarint32ToArray((uint32_t) record.size(), header);
+
+	out.write((const char *) header, end - header);
+	out.write(record.data(), record.size());
+}
+
+void write_delimited(std::ostream &out, const google::protobuf::MessageLite &message) {
+	write_delimited(out, message.SerializeAsString());
+}
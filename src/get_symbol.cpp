@@ -5,7 +5,7 @@
 
 #include <scope.pb.h>
 
-void get_symbol_command(cli_opts_t &cli_opts) {
+void get_symbol_command(cli_opts_t &cli_opts, std::ostream &out) {
 	caret_t caret(cli_opts.line, cli_opts.pos);
 	ast_t *id = find_identifier_at(ast_child(cli_opts.program), &cli_opts.pass_opt, caret, cli_opts.file);
 
@@ -32,8 +32,7 @@ void get_symbol_command(cli_opts_t &cli_opts) {
 		definition_location->set_line((int32_t) ast_line(def));
 		definition_location->set_column((int32_t) ast_pos(def));
 
-		std::ostream &msg_stream = std::cout;
-		symbol.SerializeToOstream(&msg_stream);
+		symbol.SerializeToOstream(&out);
 
 	} else {
 		LOG("Could not find id");
@@ -0,0 +1,260 @@
+#include "index.hpp"
+#include "ast_transformations.hpp"
+#include "source_index.hpp"
+#include "ExpressionTypeResolver.hpp"
+#include "logging.hpp"
+#include "snapshot.hpp"
+
+#include <intellisense.pb.h>
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <experimental/filesystem>
+
+using namespace std;
+namespace fs = std::experimental::filesystem;
+
+static bool is_member_name(ast_t *id) {
+	ast_t *parent = ast_parent(id);
+	switch (ast_id(parent)) {
+		case TK_DOT:
+		case TK_TILDE:
+		case TK_CHAIN:
+			return ast_childidx(parent, 1) == id;
+		default:
+			return false;
+	}
+}
+
+/**
+ * @return the definition id refers to, members are looked up in the type of the left side
+ */
+static ast_t *definition_of(ast_t *id, pass_opt_t *opt, bool &partial) {
+	if (!is_member_name(id))
+		return ast_get(id, ast_name(id), nullptr);
+
+	ExpressionTypeResolver resolver(ast_child(ast_parent(id)), opt);
+	auto type = resolver.resolve();
+	partial |= resolver.isPartial();
+	if (!type)
+		return nullptr;
+
+	bool members_partial = false;
+	const auto &members = type->getMembers(opt, &members_partial);
+	partial |= members_partial;
+
+	const char *name = ast_name(id);
+	for (auto &member : members)
+		if (member.get_name() == name)
+			return member.definition();
+
+	return nullptr;
+}
+
+/**
+ * @return false if type resolution ran out of budget, so some entries may be missing
+ */
+static bool index_module(ast_t *module, pass_opt_t *opt, FileIndex &index) {
+	bool partial = false;
+	index.set_file(ast_source(module)->file);
+
+	// definition files are stringtab entries, map them to their slot in definition_files
+	unordered_map<const char *, uint32_t> file_slots;
+
+	ast_t *previous = nullptr;
+	for (ast_t *id : SourceIndex::forModule(module).identifiers()) {
+		// sugar adds nodes positioned at the node they were derived from, only index the first
+		if (previous != nullptr && ast_line(previous) == ast_line(id) && ast_pos(previous) == ast_pos(id))
+			continue;
+		previous = id;
+
+		ast_t *def = definition_of(id, opt, partial);
+		source_t *source = def != nullptr ? ast_source(def) : nullptr;
+		if (source == nullptr)
+			continue;
+
+		auto slot = file_slots.emplace(source->file, (uint32_t) file_slots.size());
+		if (slot.second)
+			index.add_definition_files(source->file);
+
+		IndexEntry *entry = index.add_entries();
+		entry->set_line((uint32_t) ast_line(id));
+		entry->set_column((uint32_t) ast_pos(id));
+		entry->set_length((uint32_t) ast_name_len(id));
+		entry->set_kind((SymbolKind) (ast_id(def) - TK_VAR));
+		entry->set_definition_file(slot.first->second);
+		entry->set_definition_line((uint32_t) ast_line(def));
+		entry->set_definition_column((uint32_t) ast_pos(def));
+	}
+
+	return !partial;
+}
+
+/*
+ * On disk layout of a cached FileIndex: the header followed by the serialized FileIndex.
+ * The key covers the module's own source and the declarations of every loaded package,
+ * which is all an identifier in an unchanged module can resolve through.
+ */
+struct index_cache_header_t {
+	char magic[8];
+	uint64_t key;
+	uint32_t index_size;
+};
+
+static const char index_cache_magic[8] = {'P', 'I', 'I', 'D', 'X', '0', '0', '3'};
+
+static string index_cache_path(const cli_opts_t &options, const char *file) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.idx", (unsigned long long) content_hash(file, strlen(file)));
+	return options.cache_dir + "/index/" + name;
+}
+
+static bool load_cached_index(const string &path, uint64_t key, FileIndex &index) {
+	MappedFile mapped(path);
+	if (!mapped.valid() || mapped.size() < sizeof(index_cache_header_t))
+		return false;
+
+	auto header = (const index_cache_header_t *) mapped.data();
+	if (memcmp(header->magic, index_cache_magic, sizeof(index_cache_magic)) != 0 || header->key != key ||
+	    mapped.size() != sizeof(index_cache_header_t) + header->index_size)
+		return false;
+
+	return index.ParseFromArray(mapped.data() + sizeof(index_cache_header_t), (int) header->index_size);
+}
+
+static bool write_cached_index(const string &path, uint64_t key, const FileIndex &index) {
+	string serialized = index.SerializeAsString();
+
+	index_cache_header_t header{};
+	memcpy(header.magic, index_cache_magic, sizeof(index_cache_magic));
+	header.key = key;
+	header.index_size = (uint32_t) serialized.size();
+
+	return write_file_atomically(path, {
+			{&header, sizeof(header)},
+			{serialized.data(), serialized.size()},
+	});
+}
+
+static uint64_t hash_subtree(ast_t *ast, uint64_t key) {
+	token_id id = ast_id(ast);
+	key = content_hash(&id, sizeof(id), key);
+	if (id == TK_ID || id == TK_STRING)
+		key = content_hash(ast_name(ast), ast_name_len(ast), key);
+
+	for (ast_t *child = ast_child(ast); child != nullptr; child = ast_sibling(child))
+		key = hash_subtree(child, key);
+	return key;
+}
+
+/**
+ * @brief hashes the kind and position of a declaration and its first count children
+ */
+static uint64_t hash_declaration(ast_t *declaration, size_t count, uint64_t key) {
+	size_t position[] = {(size_t) ast_id(declaration), ast_line(declaration), ast_pos(declaration)};
+	key = content_hash(position, sizeof(position), key);
+
+	ast_t *child = ast_child(declaration);
+	for (size_t i = 0; i < count && child != nullptr; i++, child = ast_sibling(child))
+		key = hash_subtree(child, key);
+	return key;
+}
+
+/**
+ * @return hash of the signatures and positions of every entity and member in the loaded packages,
+ * 0 if indices must not be cached
+ */
+static uint64_t declarations_key(const cli_opts_t &options) {
+	// stubbed bodies and pruned modules make for incomplete indices
+	if (options.cache_dir.empty() || options.skip_bodies || options.reachable_only)
+		return 0;
+
+	uint64_t key = content_hash(PONYC_VERSION, strlen(PONYC_VERSION));
+	for (ast_t *package = ast_child(options.program); package != nullptr; package = ast_sibling(package)) {
+		vector<ast_t *> modules;
+		for (ast_t *module = ast_child(package); module != nullptr; module = ast_sibling(module))
+			if (ast_source(module) != nullptr)
+				modules.push_back(module);
+
+		sort(modules.begin(), modules.end(), [](ast_t *a, ast_t *b) {
+			return strcmp(ast_source(a)->file, ast_source(b)->file) < 0;
+		});
+
+		for (ast_t *module : modules) {
+			const char *file = ast_source(module)->file;
+			key = content_hash(file, strlen(file), key);
+
+			for (ast_t *entity = ast_child(module); entity != nullptr; entity = ast_sibling(entity)) {
+				if (ast_id(entity) == TK_USE)
+					continue;
+
+				// name, typeparams, cap and provides, which holds the aliased type of a TK_TYPE
+				key = hash_declaration(entity, TYPE_MEMBERS, key);
+
+				ast_t *members = ast_childidx(entity, TYPE_MEMBERS);
+				for (ast_t *member = ast_child(members); member != nullptr; member = ast_sibling(member)) {
+					bool is_field = ast_id(member) == TK_FVAR || ast_id(member) == TK_FLET || ast_id(member) == TK_EMBED;
+					// fields: id and type, methods: cap, id, typeparams, params, result and partial, not the body
+					key = hash_declaration(member, is_field ? 2 : 6, key);
+				}
+			}
+		}
+	}
+	return key;
+}
+
+/**
+ * @brief indexes module, reusing the index cached for it if neither its source nor any declaration changed since
+ * @param declarations from declarations_key
+ */
+static void index_module_cached(ast_t *module, cli_opts_t &options, uint64_t declarations, FileIndex &index) {
+	source_t *source = ast_source(module);
+	if (declarations == 0 || source == nullptr) {
+		index_module(module, &options.pass_opt, index);
+		return;
+	}
+
+	string path = index_cache_path(options, source->file);
+	uint64_t key = content_hash(source->m, source->len, content_hash(source->file, strlen(source->file), declarations));
+	if (load_cached_index(path, key, index))
+		return;
+
+	index.Clear();
+	if (!index_module(module, &options.pass_opt, index))
+		return;
+
+	std::error_code error;
+	fs::create_directories(options.cache_dir + "/index", error);
+	if (!write_cached_index(path, key, index))
+		LOG("could not write index cache %s", path.c_str());
+}
+
+void index_file_command(cli_opts_t &options, std::ostream &out) {
+	ast_t *module = find_module(ast_child(options.program), stringtab(options.file.c_str()));
+	if (module == nullptr) {
+		LOG("%s is not part of the loaded package", options.file.c_str());
+		return;
+	}
+
+	FileIndex index;
+	index_module_cached(module, options, declarations_key(options), index);
+	index.SerializeToOstream(&out);
+}
+
+void index_package_command(cli_opts_t &options, std::ostream &out) {
+	vector<ast_t *> modules;
+	for (ast_t *module = ast_child(ast_child(options.program)); module != nullptr; module = ast_sibling(module))
+		modules.push_back(module);
+
+	sort(modules.begin(), modules.end(), [](ast_t *a, ast_t *b) {
+		return strcmp(ast_source(a)->file, ast_source(b)->file) < 0;
+	});
+
+	uint64_t declarations = declarations_key(options);
+	PackageIndex index;
+	for (ast_t *module : modules)
+		index_module_cached(module, options, declarations, *index.add_files());
+	index.SerializeToOstream(&out);
+}
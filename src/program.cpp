@@ -0,0 +1,427 @@
+#include "main.hpp"
+#include "ponyc_includes.hpp"
+#include "cli_opts.hpp"
+#include "ast_transformations.hpp"
+#include "logging.hpp"
+#include "source_index.hpp"
+#include "PonyType.hpp"
+#include "ExpressionTypeResolver.hpp"
+#include "stats.hpp"
+#include "workspace_symbols.hpp"
+
+extern "C" {
+#include <ast/astbuild.h>
+}
+
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+
+static std::vector<const char *> get_source_files_in(const char *dir_path, pass_opt_t *opt);
+
+extern "C" {
+const char *find_path(ast_t *from, const char *path, bool *out_is_relative, pass_opt_t *opt);
+ast_t *create_package(ast_t *program, const char *name, const char *qualified_name, pass_opt_t *opt);
+}
+
+static bool parse_dir_files(ast_t *package, cli_opts_t options, pass_opt_t *pass) {
+	bool rv = true;
+
+	auto files = get_source_files_in(options.path.c_str(), pass);
+	for (auto &file : files) {
+		fs::path path(options.path.c_str());
+		path /= fs::path(file);
+
+		const char *err_msg = nullptr;
+		bool source_is_stdin = path.string() == options.file && options.override_file_content != nullptr;
+		source_t *source = source_is_stdin ? source_open_string(options.override_file_content)
+		                                   : source_open(path.string().c_str(), &err_msg);
+
+		if (source == nullptr) {
+			if (err_msg == nullptr)
+				err_msg = "couldn't open file";
+
+			errorf(pass->check.errors, file, "%s", file);
+			return false;
+		}
+
+		if (source_is_stdin)
+			source->file = stringtab(options.file.c_str());
+		rv &= module_passes(package, pass, source);
+	}
+
+	return rv;
+}
+
+static ast_t *load_package_custom(ast_t *from, cli_opts_t &options, pass_opt_t *pass) {
+	pony_assert(from != nullptr);
+
+	bool is_relative = false;
+	const char *full_path = options.path.c_str();
+	const char *qualified_name = full_path;
+	ast_t *program = ast_nearest(from, TK_PROGRAM);
+
+	full_path = find_path(from, options.path.c_str(), &is_relative, pass);
+	if (full_path == nullptr) {
+		errorf(pass->check.errors, options.path.c_str(), "couldn't locate this path");
+		return nullptr;
+	}
+
+	if ((from != program) && is_relative) {
+		auto *from_pkg = (ast_t *) ast_data(ast_child(program));
+		if (from_pkg != nullptr) {
+			const char *base_name = package_qualified_name(from_pkg);
+			size_t base_name_len = strlen(base_name);
+			size_t path_len = options.path.size();
+			size_t len = base_name_len + path_len + 2;
+
+			auto *q_name = (char *) ponyint_pool_alloc_size(len);
+			memcpy(q_name, base_name, base_name_len);
+			q_name[base_name_len] = '/';
+			memcpy(q_name + base_name_len + 1, options.path.c_str(), path_len);
+			q_name[len - 1] = '\0';
+			qualified_name = stringtab_consume(q_name, len);
+		}
+	}
+
+	ast_t *package = ast_get(program, full_path, nullptr);
+
+	if (package != nullptr)
+		return package;
+
+	package = create_package(program, full_path, qualified_name, pass);
+
+	if (pass->verbosity >= VERBOSITY_INFO)
+		fprintf(stderr, "Building %s -> %s\n", options.path.c_str(), full_path);
+
+	if (!parse_dir_files(package, options, pass))
+		return nullptr;
+
+	if (ast_child(package) == nullptr) {
+		ast_error(pass->check.errors, package, "no source files in package '%s'", options.path.c_str());
+		return nullptr;
+	}
+
+	if (!ast_passes_subtree(&package, pass, pass->program_pass)) {
+		ast_setflag(package, AST_FLAG_PRESERVE);
+		return nullptr;
+	}
+
+	return package;
+}
+
+static void collect_names(ast_t *ast, std::vector<const char *> &names) {
+	for (ast_t *child = ast_child(ast); child != nullptr; child = ast_sibling(child)) {
+		if (ast_id(child) == TK_ID)
+			names.push_back(ast_name(child));
+		else
+			collect_names(child, names);
+	}
+}
+
+/**
+ * @brief removes the modules of package that the module parsed from file can't reach
+ *
+ * A module is reachable if it defines a type named in a reachable module. `use` directives
+ * are only processed by the scope pass, so the packages used by removed modules are never loaded.
+ * Runs right after parsing, before anything was added to the package's symbol table.
+ */
+static void prune_unreachable_modules(ast_t *package, const std::string &file) {
+	ast_t *target = find_module(package, stringtab(file.c_str()));
+	if (target == nullptr)
+		return;
+
+	// top level definitions are stringtab entries, so pointers identify their names
+	std::unordered_map<const char *, ast_t *> definitions;
+	for (ast_t *module = ast_child(package); module != nullptr; module = ast_sibling(module))
+		for (ast_t *def = ast_child(module); def != nullptr; def = ast_sibling(def))
+			if (ast_id(def) != TK_USE)
+				definitions.emplace(ast_name(ast_child(def)), module);
+
+	std::unordered_set<ast_t *> reachable{target};
+	std::vector<ast_t *> pending{target};
+	std::vector<const char *> names;
+	while (!pending.empty()) {
+		ast_t *module = pending.back();
+		pending.pop_back();
+
+		names.clear();
+		collect_names(module, names);
+		for (auto name : names) {
+			auto it = definitions.find(name);
+			if (it != definitions.end() && reachable.insert(it->second).second)
+				pending.push_back(it->second);
+		}
+	}
+
+	for (ast_t *module = ast_child(package); module != nullptr;) {
+		ast_t *next = ast_sibling(module);
+		if (reachable.count(module) == 0) {
+			LOG("skipping unreachable module %s", ast_source(module)->file);
+			ast_remove(module);
+		}
+		module = next;
+	}
+}
+
+static size_t stub_method_bodies(ast_t *entity, ast_t *keep) {
+	size_t stubbed = 0;
+	for (ast_t *member = ast_child(ast_childidx(entity, 4)); member != nullptr; member = ast_sibling(member)) {
+		switch (ast_id(member)) {
+			case TK_NEW:
+			case TK_FUN:
+			case TK_BE:
+				break;
+			default:
+				continue;
+		}
+
+		ast_t *body = ast_childidx(member, 6);
+		if (member == keep || ast_id(body) != TK_SEQ)
+			continue;
+
+		// `error` is the smallest body every method kind accepts
+		BUILD(stub, body, NODE(TK_SEQ, NODE(TK_ERROR, NONE)));
+		ast_replace(&body, stub);
+		stubbed++;
+	}
+	return stubbed;
+}
+
+/**
+ * @brief replaces method bodies with stubs, so the passes only see declarations
+ *
+ * The body of the method around the caret is kept. Without a caret, e.g. when serving,
+ * every body in --file is kept since later queries may point anywhere into it.
+ */
+static void skip_bodies(ast_t *program, const cli_opts_t &options) {
+	ast_t *package = ast_child(program);
+	const char *file = stringtab(options.file.c_str());
+	ast_t *caret_module = find_module(package, file);
+	ast_t *keep = caret_module != nullptr && options.line > 0 ? enclosing_declaration(caret_module, options.line) : nullptr;
+
+	size_t stubbed = 0;
+	for (; package != nullptr; package = ast_sibling(package)) {
+		for (ast_t *module = ast_child(package); module != nullptr; module = ast_sibling(module)) {
+			if (module == caret_module && keep == nullptr)
+				continue;
+
+			for (ast_t *entity = ast_child(module); entity != nullptr; entity = ast_sibling(entity))
+				if (ast_id(entity) != TK_USE)
+					stubbed += stub_method_bodies(entity, keep);
+		}
+	}
+
+	if (options.pass_opt.verbosity >= VERBOSITY_INFO)
+		fprintf(stderr, "Skipped %zu method bodies\n", stubbed);
+}
+
+bool init_pass_opt(pass_opt_t &pass) {
+	pass_opt_init(&pass);
+	pass.release = false;
+	pass.print_stats = stats_enabled();
+	pass.ast_print_width = 80;
+	pass.verify = false;
+	pass.allow_test_symbols = true;
+	pass.program_pass = PASS_PARSE;
+	pass.verbosity = VERBOSITY_MINIMAL;
+
+	opt_state_t state{};
+	ponyint_opt_init(ponyc_opt_std_args(), &state, nullptr, nullptr);
+	if (!ponyc_init(&pass)) {
+		fprintf(stderr, "Error initializing ponyc\n");
+		return false;
+	}
+	return true;
+}
+
+bool load_program(cli_opts_t &options, pass_opt_t &pass, ast_t *&program) {
+	program = ast_blank(TK_PROGRAM);
+	ast_scope(program);
+
+	ast_t *loaded_builtin;
+	{
+		stats_timer_t timer(stats_phase_t::builtin_load);
+		loaded_builtin = package_load(program, stringtab("builtin"), &pass);
+	}
+	if (loaded_builtin == nullptr) {
+		ast_free(program);
+		fprintf(stderr, "1\n");
+		return false;
+	}
+
+	ast_t *package;
+	{
+		stats_timer_t timer(stats_phase_t::package_parse);
+		package = load_package_custom(program, options, &pass);
+	}
+	if (!package) {
+		ast_free(program);
+		fprintf(stderr, "2\n");
+		return false;
+	}
+
+	if (options.reachable_only)
+		prune_unreachable_modules(package, options.file);
+
+	ast_t *builtin = ast_pop(program);
+	ast_append(program, builtin);
+
+	if (options.skip_bodies)
+		skip_bodies(program, options);
+
+	bool resolved;
+	{
+		stats_timer_t timer(stats_phase_t::name_resolution);
+		resolved = ast_passes_subtree(&program, &pass, PASS_NAME_RESOLUTION);
+	}
+	if (!resolved) {
+		ast_free(program);
+		fprintf(stderr, "3\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool load_program_from_options(cli_opts_t &options, pass_opt_t &pass, ast_t *&program) {
+	return init_pass_opt(pass) && load_program(options, pass, program);
+}
+
+std::vector<const char *> get_source_files_in(const char *dir_path, pass_opt_t *) {
+	fs::path path(dir_path);
+	std::vector<const char *> rv;
+
+	for (const auto &entry : fs::directory_iterator(path)) {
+		auto filename = entry.path().filename();
+		if (!fs::is_regular_file(entry.status()))
+			continue;
+		if (filename.c_str()[0] == '.')
+			continue;
+
+		const char *ext = strrchr(filename.c_str(), '.');
+
+		if (ext != nullptr && strcmp(ext, ".pony") == 0)
+			rv.push_back(stringtab(filename.c_str()));
+	}
+
+	std::sort(rv.begin(), rv.end(), strcmp);
+
+	return rv;
+}
+
+
+
+/**
+ * Modules replaced by reparse_module that nominals elsewhere still point into,
+ * because the definition they name is gone from the new module.
+ */
+static std::unordered_set<ast_t *> retired_modules;
+
+static ast_t *retired_module_of(ast_t *def) {
+	ast_t *module = ast_nearest(def, TK_MODULE);
+	return retired_modules.count(module) > 0 ? module : nullptr;
+}
+
+/**
+ * @brief points nominals at definitions in retired modules to the definition of the same name
+ * in package, then frees every retired module that nothing points into anymore
+ */
+static void release_retired_modules(ast_t *program, ast_t *package) {
+	std::unordered_set<ast_t *> referenced;
+	std::vector<ast_t *> pending;
+	for (ast_t *loaded = ast_child(program); loaded != nullptr; loaded = ast_sibling(loaded))
+		// builtin doesn't use any other package
+		if (strcmp(package_qualified_name(loaded), "builtin") != 0)
+			pending.push_back(loaded);
+
+	while (!pending.empty()) {
+		ast_t *node = pending.back();
+		pending.pop_back();
+
+		auto def = (ast_t *) (ast_id(node) == TK_NOMINAL ? ast_data(node) : nullptr);
+		ast_t *retired = def != nullptr ? retired_module_of(def) : nullptr;
+		if (retired != nullptr) {
+			ast_t *replacement = ast_get(package, ast_name(ast_child(def)), nullptr);
+			if (replacement != nullptr && retired_module_of(replacement) == nullptr)
+				ast_setdata(node, replacement);
+			else if (referenced.insert(retired).second)
+				// whatever the kept module points at has to stay as well
+				pending.push_back(retired);
+		}
+
+		for (ast_t *child = ast_child(node); child != nullptr; child = ast_sibling(child))
+			pending.push_back(child);
+	}
+
+	for (auto it = retired_modules.begin(); it != retired_modules.end();) {
+		if (referenced.count(*it) > 0) {
+			++it;
+			continue;
+		}
+		ast_free(*it);
+		it = retired_modules.erase(it);
+	}
+}
+
+static void forget_module_symbols(ast_t *package, ast_t *module) {
+	symtab_t *symtab = ast_get_symtab(package);
+	size_t i = HASHMAP_BEGIN;
+
+	for (symbol_t *symbol = symtab_next(symtab, &i); symbol != nullptr; symbol = symtab_next(symtab, &i)) {
+		if (symbol->def == nullptr || ast_nearest(symbol->def, TK_MODULE) != module)
+			continue;
+
+		symtab_removeindex(symtab, i);
+		POOL_FREE(symbol_t, symbol);
+	}
+}
+
+bool reparse_module(cli_opts_t &options, const std::string &file, const char *content) {
+	pass_opt_t *pass = &options.pass_opt;
+	ast_t *package = ast_child(options.program);
+	const char *filename = stringtab(file.c_str());
+
+	ast_t *old_module = find_module(package, filename);
+	if (old_module == nullptr) {
+		errorf(pass->check.errors, filename, "file is not part of the loaded package");
+		return false;
+	}
+
+	source_t *source = source_open_string(content);
+	source->file = filename;
+
+	// module_passes adds the new module as first child of the package
+	ast_t *first = ast_child(package);
+	bool parsed = module_passes(package, pass, source);
+	ast_t *module = ast_child(package) != first ? ast_pop(package) : nullptr;
+
+	if (!parsed) {
+		if (module != nullptr)
+			ast_free(module);
+		return false;
+	}
+
+	forget_module_symbols(package, old_module);
+	SourceIndex::invalidate(old_module);
+	PonyType::clearMemberCache();
+	ExpressionTypeResolver::clearCache();
+	invalidate_workspace_symbols();
+	ast_swap(old_module, module);
+	retired_modules.insert(old_module);
+
+	// we don't start at the program, so set up the frames ast_passes would have pushed
+	frame_push(&pass->check, nullptr);
+	frame_push(&pass->check, package);
+	bool resolved = ast_passes_subtree(&module, pass, PASS_NAME_RESOLUTION);
+	frame_pop(&pass->check);
+	frame_pop(&pass->check);
+
+	release_retired_modules(options.program, package);
+
+	return resolved;
+}
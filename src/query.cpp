@@ -0,0 +1,44 @@
+#include "query.hpp"
+#include "dump_ast.hpp"
+#include "dump_scope.hpp"
+#include "get_symbol.hpp"
+#include "index.hpp"
+#include "workspace_symbols.hpp"
+
+void add_query_subcommands(CLI::App &app, cli_opts_t &options, std::ostream &out) {
+	app.add_subcommand("dump-ast")
+			->set_callback([&]() {
+				dump_ast(options, out);
+			});
+
+	{
+		auto cmd = app.add_subcommand("dump-scope");
+		CARET_OPT(cmd, options);
+		cmd->add_flag("--stream", options.stream, "write symbols as length-delimited records followed by a trailer");
+		cmd->add_option("--prefix", options.prefix, "only complete names starting with prefix", false);
+		cmd->add_option("--limit", options.limit, "maximum number of completions, closest first", false);
+		cmd->set_callback([&]() {
+			dump_scope(options, out);
+		});
+	}
+
+	{
+		auto cmd = app.add_subcommand("get-symbol");
+		CARET_OPT(cmd, options);
+
+		cmd->set_callback([&]() { get_symbol_command(options, out); });
+	}
+
+	app.add_subcommand("index-file", "map every identifier of --file to its definition")
+			->set_callback([&]() { index_file_command(options, out); });
+
+	app.add_subcommand("index-package", "map every identifier of the package to its definition")
+			->set_callback([&]() { index_package_command(options, out); });
+
+	{
+		auto cmd = app.add_subcommand("workspace-symbols", "find declarations across all loaded packages by name");
+		cmd->add_option("--query", options.symbol_query, "name to search for, matched fuzzily", false)->required();
+		cmd->add_option("--limit", options.limit, "maximum number of symbols, best first (default 100)", false);
+		cmd->set_callback([&]() { workspace_symbols_command(options, out); });
+	}
+}
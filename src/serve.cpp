@@ -0,0 +1,110 @@
+#include "serve.hpp"
+#include "main.hpp"
+#include "query.hpp"
+#include "framing.hpp"
+#include "logging.hpp"
+#include "stats.hpp"
+#include "PonyType.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+// content each file was last reparsed with, so unchanged buffers don't cause a reparse
+static unordered_map<string, string> reparsed_content;
+
+static void update_file(cli_opts_t &options, const string &file, const char *content) {
+	auto it = reparsed_content.find(file);
+	if (it != reparsed_content.end() && it->second == content)
+		return;
+
+	if (!reparse_module(options, file, content)) {
+		errors_print(options.pass_opt.check.errors);
+		errors_free(options.pass_opt.check.errors);
+		options.pass_opt.check.errors = errors_alloc();
+	}
+
+	reparsed_content[file] = content;
+}
+
+static void answer_request(cli_opts_t &options, const string &request, ostream &out) {
+	size_t newline = request.find('\n');
+	const char *content = newline != string::npos ? request.c_str() + newline + 1 : nullptr;
+
+	istringstream request_stream(request.substr(0, newline));
+	vector<string> args{istream_iterator<string>(request_stream), istream_iterator<string>()};
+	reverse(args.begin(), args.end());
+
+	cli_opts_t query = options;
+	query.line = 0;
+	query.pos = 0;
+	query.stream = false;
+	query.prefix.clear();
+	query.limit = 0;
+	query.symbol_query.clear();
+
+	CLI::App app{"serve request"};
+	app.add_option("--file", query.file, "file to inspect", true);
+	add_query_subcommands(app, query, out);
+	app.require_subcommand(1);
+	app.set_callback([&]() {
+		if (content == nullptr)
+			return;
+
+		update_file(options, query.file, content);
+		query.pass_opt = options.pass_opt;
+	});
+
+	try {
+		app.parse(args);
+	} catch (const CLI::ParseError &e) {
+		LOG("invalid request '%s': %s", request.c_str(), e.what());
+	}
+
+	// nothing holds on to member tables between requests
+	PonyType::dropPartialMembers();
+}
+
+void serve_command(cli_opts_t &options) {
+	string request;
+
+	// loading the program, requests are reported one by one
+	stats_report(cerr);
+	stats_reset();
+
+	while (read_delimited(cin, request)) {
+		ostringstream response;
+		answer_request(options, request, response);
+
+		write_delimited(cout, response.str());
+		cout.flush();
+
+		stats_report(cerr);
+		stats_reset();
+	}
+}
+
+void batch_command(cli_opts_t &options, istream &in) {
+	string query;
+
+	// the program is loaded once and shared, like the caches and indices built while answering
+	stats_report(cerr);
+	stats_reset();
+
+	while (getline(in, query)) {
+		if (query.empty() || query[0] == '#')
+			continue;
+
+		ostringstream response;
+		answer_request(options, query, response);
+		write_delimited(cout, response.str());
+	}
+
+	cout.flush();
+	stats_report(cerr);
+	stats_reset();
+}
@@ -0,0 +1,316 @@
+#include "snapshot.hpp"
+#include "PonyType.hpp"
+#include "ExpressionTypeResolver.hpp"
+#include "ast_transformations.hpp"
+#include "logging.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <experimental/filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::experimental::filesystem;
+
+static const char snapshot_magic[8] = {'P', 'I', 'S', 'N', 'A', 'P', '0', '1'};
+
+// part of the key, bump when the snapshot_*_t records or the way members are collected change
+static const uint32_t snapshot_format_version = 2;
+
+uint64_t content_hash(const void *data, size_t len, uint64_t seed) {
+	auto bytes = (const unsigned char *) data;
+	uint64_t hash = seed;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+MappedFile::MappedFile(const string &path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st{};
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			m_Data = data;
+			m_Size = (size_t) st.st_size;
+		}
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (m_Data != nullptr)
+		munmap(m_Data, m_Size);
+}
+
+bool write_file_atomically(const string &path, initializer_list<file_chunk_t> chunks) {
+	string tmp_path = path + ".tmp." + to_string(getpid());
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	bool ok = true;
+	for (auto &chunk : chunks)
+		ok &= chunk.size == 0 || fwrite(chunk.data, 1, chunk.size, file) == chunk.size;
+	ok &= fclose(file) == 0;
+
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+BuiltinSnapshot::BuiltinSnapshot(const string &path, uint64_t key) : m_File(path) {
+	if (!m_File.valid() || m_File.size() < sizeof(snapshot_header_t))
+		return;
+
+	auto header = (const snapshot_header_t *) m_File.data();
+	if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header->key != key)
+		return;
+
+	size_t types_offset = sizeof(snapshot_header_t);
+	size_t members_offset = types_offset + header->type_count * sizeof(snapshot_type_t);
+	size_t params_offset = members_offset + header->member_count * sizeof(snapshot_member_t);
+	size_t strings_offset = params_offset + header->param_count * sizeof(snapshot_param_t);
+
+	if (strings_offset + header->strings_size != m_File.size())
+		return;
+
+	m_Types = (const snapshot_type_t *) (m_File.data() + types_offset);
+	m_Members = (const snapshot_member_t *) (m_File.data() + members_offset);
+	m_Params = (const snapshot_param_t *) (m_File.data() + params_offset);
+	m_Strings = m_File.data() + strings_offset;
+	m_Header = header;
+}
+
+const snapshot_type_t *BuiltinSnapshot::findType(const char *name) const {
+	if (!valid())
+		return nullptr;
+
+	auto end = m_Types + m_Header->type_count;
+	auto it = lower_bound(m_Types, end, name, [this](const snapshot_type_t &type, const char *n) {
+		return strcmp(str(type.name), n) < 0;
+	});
+
+	if (it == end || strcmp(str(it->name), name) != 0)
+		return nullptr;
+	return it;
+}
+
+uint64_t sources_key(const vector<ast_t *> &packages) {
+	uint64_t key = content_hash(PONYC_VERSION, strlen(PONYC_VERSION));
+
+	// modules are hashed in file name order, packages keep them in parse order
+	vector<source_t *> sources;
+	for (ast_t *package : packages)
+		for (ast_t *module = ast_child(package); module != nullptr; module = ast_sibling(module))
+			if (ast_source(module) != nullptr)
+				sources.push_back(ast_source(module));
+
+	sort(sources.begin(), sources.end(), [](source_t *a, source_t *b) { return strcmp(a->file, b->file) < 0; });
+
+	for (auto &source : sources) {
+		key = content_hash(source->file, strlen(source->file), key);
+		key = content_hash(source->m, source->len, key);
+	}
+	return key;
+}
+
+uint64_t builtin_snapshot_key(ast_t *builtin) {
+	return content_hash(&snapshot_format_version, sizeof(snapshot_format_version), sources_key({builtin}));
+}
+
+struct snapshot_builder_t {
+	vector<snapshot_type_t> types;
+	vector<snapshot_member_t> members;
+	vector<snapshot_param_t> params;
+	string strings{'\0'};
+	unordered_map<string, uint32_t> string_offsets;
+	// set if resolving ran out of budget, the records may then miss types and members
+	bool partial = false;
+
+	uint32_t intern(const string &value) {
+		if (value.empty())
+			return 0;
+
+		auto it = string_offsets.find(value);
+		if (it != string_offsets.end())
+			return it->second;
+
+		auto offset = (uint32_t) strings.size();
+		strings.append(value).push_back('\0');
+		string_offsets.emplace(value, offset);
+		return offset;
+	}
+
+	uint32_t intern_file(ast_t *def) {
+		source_t *source = ast_source(def);
+		return source != nullptr && source->file != nullptr ? intern(source->file) : 0;
+	}
+
+	void add_member(const PonyMember &member, pass_opt_t *opt) {
+		snapshot_member_t record{};
+		record.name = intern(member.get_name());
+		record.docstring = intern(member.get_docstring());
+		record.file = intern_file(member.definition());
+		record.line = (uint32_t) ast_line(member.definition());
+		record.column = (uint32_t) ast_pos(member.definition());
+		record.kind = (uint32_t) member.m_Kind;
+		record.first_param = (uint32_t) params.size();
+
+		if (member.get_type()) {
+			record.type_name = intern(member.get_type()->name());
+			record.type_docstring = intern(member.get_type()->docstring());
+		}
+
+		if ((member.m_Kind == fun || member.m_Kind == be) && member.get_type()) {
+			ast_t *member_params = ast_childidx(member.definition(), 3);
+			for (ast_t *param = ast_child(member_params); param != nullptr; param = ast_sibling(param)) {
+				snapshot_param_t param_record{};
+				param_record.name = intern(ast_name(ast_child(param)));
+
+				ExpressionTypeResolver resolver(ast_childidx(param, 1), opt);
+				auto param_type = resolver.resolve(member.get_type());
+				partial |= resolver.isPartial();
+				if (param_type) {
+					param_record.type_name = intern(param_type->name());
+					param_record.type_docstring = intern(param_type->docstring());
+				}
+
+				params.push_back(param_record);
+				record.param_count++;
+			}
+		}
+
+		members.push_back(record);
+	}
+
+	void add_type(ast_t *def, pass_opt_t *opt) {
+		PonyType type = PonyType::fromDefinition(def);
+
+		snapshot_type_t record{};
+		record.name = intern(type.name());
+		record.docstring = intern(type.docstring());
+		record.file = intern_file(def);
+		record.line = (uint32_t) ast_line(def);
+		record.column = (uint32_t) ast_pos(def);
+		record.typeparam_count = (uint32_t) ast_childcount(ast_childidx(def, TYPE_PARAMS));
+		record.first_member = (uint32_t) members.size();
+
+		SymbolKind kind;
+		record.kind = SymbolKind_Parse(token_id_desc(ast_id(def)), &kind) ? (uint32_t) kind : (uint32_t) unknown;
+
+		bool members_partial = false;
+		const auto &type_members = type.getMembers(opt, &members_partial);
+		partial |= members_partial;
+
+		for (auto &member : type_members) {
+			add_member(member, opt);
+			record.member_count++;
+		}
+
+		types.push_back(record);
+	}
+};
+
+bool write_builtin_snapshot(const string &path, uint64_t key, ast_t *builtin, pass_opt_t *opt) {
+	snapshot_builder_t builder;
+
+	for (ast_t *module = ast_child(builtin); module != nullptr; module = ast_sibling(module)) {
+		for (ast_t *entity = ast_child(module); entity != nullptr; entity = ast_sibling(entity)) {
+			switch (ast_id(entity)) {
+				case TK_CLASS:
+				case TK_ACTOR:
+				case TK_STRUCT:
+				case TK_PRIMITIVE:
+				case TK_TRAIT:
+				case TK_INTERFACE:
+					builder.add_type(entity, opt);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	// a snapshot is reused until builtin changes, so never persist an incomplete one
+	if (builder.partial) {
+		LOG("resolving builtin ran out of budget, not writing a snapshot");
+		return false;
+	}
+
+	sort(builder.types.begin(), builder.types.end(), [&builder](const snapshot_type_t &a, const snapshot_type_t &b) {
+		return strcmp(&builder.strings[a.name], &builder.strings[b.name]) < 0;
+	});
+
+	snapshot_header_t header{};
+	memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+	header.key = key;
+	header.type_count = (uint32_t) builder.types.size();
+	header.member_count = (uint32_t) builder.members.size();
+	header.param_count = (uint32_t) builder.params.size();
+	header.strings_size = (uint32_t) builder.strings.size();
+
+	return write_file_atomically(path, {
+			{&header, sizeof(header)},
+			{builder.types.data(), builder.types.size() * sizeof(snapshot_type_t)},
+			{builder.members.data(), builder.members.size() * sizeof(snapshot_member_t)},
+			{builder.params.data(), builder.params.size() * sizeof(snapshot_param_t)},
+			{builder.strings.data(), builder.strings.size()},
+	});
+}
+
+static unique_ptr<BuiltinSnapshot> loaded_snapshot;
+static ast_t *loaded_snapshot_builtin = nullptr;
+
+static void load_builtin_snapshot(cli_opts_t &options, ast_t *builtin) {
+	loaded_snapshot.reset();
+
+	if (options.cache_dir.empty())
+		return;
+
+	std::error_code error;
+	fs::create_directories(options.cache_dir, error);
+	string path = options.cache_dir + "/builtin.snapshot";
+	uint64_t key = builtin_snapshot_key(builtin);
+
+	auto snapshot = make_unique<BuiltinSnapshot>(path, key);
+	if (!snapshot->valid()) {
+		if (!write_builtin_snapshot(path, key, builtin, &options.pass_opt)) {
+			LOG("could not write builtin snapshot to %s", path.c_str());
+			return;
+		}
+		snapshot = make_unique<BuiltinSnapshot>(path, key);
+	}
+
+	if (snapshot->valid())
+		loaded_snapshot = move(snapshot);
+}
+
+const BuiltinSnapshot *builtin_snapshot(cli_opts_t &options, ast_t *builtin) {
+	// a failed load is remembered as well, so it is only attempted once per builtin package
+	if (loaded_snapshot_builtin != builtin) {
+		loaded_snapshot_builtin = builtin;
+		load_builtin_snapshot(options, builtin);
+	}
+	return loaded_snapshot.get();
+}
+
+bool is_builtin_definition(ast_t *definition) {
+	ast_t *package = ast_nearest(definition, TK_PACKAGE);
+	return package != nullptr && strcmp(package_qualified_name(package), "builtin") == 0;
+}
@@ -0,0 +1,69 @@
+#include "source_index.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+using namespace std;
+
+static bool position_less(ast_t *a, ast_t *b) {
+	if (ast_line(a) != ast_line(b))
+		return ast_line(a) < ast_line(b);
+	return ast_pos(a) < ast_pos(b);
+}
+
+SourceIndex::SourceIndex(ast_t *module) {
+	source_t *module_source = ast_source(module);
+	const char *file = module_source != nullptr ? module_source->file : nullptr;
+
+	vector<ast_t *> pending{module};
+	while (!pending.empty()) {
+		ast_t *node = pending.back();
+		pending.pop_back();
+
+		for (ast_t *child = ast_child(node); child != nullptr; child = ast_sibling(child))
+			pending.push_back(child);
+
+		if (ast_id(node) != TK_ID)
+			continue;
+
+		source_t *source = ast_source(node);
+		if (source != nullptr && source->file == file)
+			m_Ids.push_back(node);
+	}
+
+	stable_sort(m_Ids.begin(), m_Ids.end(), position_less);
+}
+
+ast_t *SourceIndex::identifierAt(caret_t const &position) const {
+	// first id starting after the caret, candidates are the ids before it on the same line
+	auto it = upper_bound(m_Ids.begin(), m_Ids.end(), position, [](caret_t const &caret, ast_t *id) {
+		if (caret.line != ast_line(id))
+			return caret.line < ast_line(id);
+		return caret.column < ast_pos(id);
+	});
+
+	while (it != m_Ids.begin()) {
+		ast_t *id = *--it;
+		if (ast_line(id) != position.line)
+			break;
+
+		if (position.in_range(caret_t(ast_line(id), ast_pos(id)), ast_name_len(id)))
+			return id;
+	}
+
+	return nullptr;
+}
+
+static unordered_map<ast_t *, unique_ptr<SourceIndex>> module_indices;
+
+const SourceIndex &SourceIndex::forModule(ast_t *module) {
+	auto &index = module_indices[module];
+	if (index == nullptr)
+		index = make_unique<SourceIndex>(module);
+	return *index;
+}
+
+void SourceIndex::invalidate(ast_t *module) {
+	module_indices.erase(module);
+}
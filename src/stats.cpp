@@ -0,0 +1,80 @@
+#include "stats.hpp"
+
+#include <sys/resource.h>
+
+using namespace std;
+
+static bool enabled = false;
+static bool recorded = false;
+static chrono::steady_clock::duration phase_times[(size_t) stats_phase_t::count];
+static size_t counters[(size_t) stats_counter_t::count];
+
+static const char *phase_names[] = {
+		"builtin_load_us",
+		"package_parse_us",
+		"name_resolution_us",
+		"scope_walk_us",
+		"type_resolution_us",
+		"serialization_us",
+};
+
+static const char *counter_names[] = {
+		"nodes_visited",
+		"resolver_frames",
+		"resolver_cache_hits",
+		"resolver_cache_misses",
+		"members_collected",
+		"bytes_serialized",
+};
+
+static_assert(sizeof(phase_names) / sizeof(*phase_names) == (size_t) stats_phase_t::count, "every phase needs a name");
+static_assert(sizeof(counter_names) / sizeof(*counter_names) == (size_t) stats_counter_t::count, "every counter needs a name");
+
+void stats_enable() {
+	enabled = true;
+}
+
+bool stats_enabled() {
+	return enabled;
+}
+
+void stats_count(stats_counter_t counter, size_t amount) {
+	if (!enabled)
+		return;
+
+	counters[(size_t) counter] += amount;
+	recorded = true;
+}
+
+void stats_add_time(stats_phase_t phase, chrono::steady_clock::duration duration) {
+	if (!enabled)
+		return;
+
+	phase_times[(size_t) phase] += duration;
+	recorded = true;
+}
+
+void stats_report(ostream &out) {
+	if (!enabled || !recorded)
+		return;
+
+	out << "stats begin\n";
+	for (size_t i = 0; i < (size_t) stats_phase_t::count; i++)
+		out << phase_names[i] << ' ' << chrono::duration_cast<chrono::microseconds>(phase_times[i]).count() << '\n';
+	for (size_t i = 0; i < (size_t) stats_counter_t::count; i++)
+		out << counter_names[i] << ' ' << counters[i] << '\n';
+
+	rusage usage{};
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		out << "peak_rss_kb " << usage.ru_maxrss << '\n';
+	out << "stats end\n";
+	out.flush();
+}
+
+void stats_reset() {
+	for (auto &time : phase_times)
+		time = chrono::steady_clock::duration::zero();
+	for (auto &counter : counters)
+		counter = 0;
+	recorded = false;
+}
@@ -0,0 +1,246 @@
+#include "workspace_symbols.hpp"
+#include "logging.hpp"
+#include "ast_transformations.hpp"
+
+#include <scope.pb.h>
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct declaration_t {
+	ast_t *def;
+	const char *name;
+	// lower case name, matching is case-insensitive
+	string key;
+};
+
+static uint32_t trigram(const string &s, size_t i) {
+	return (uint32_t) (unsigned char) s[i] << 16 | (uint32_t) (unsigned char) s[i + 1] << 8 | (unsigned char) s[i + 2];
+}
+
+/**
+ * @return name of a type or member, methods have their capability before the TK_ID
+ */
+static const char *declaration_name(ast_t *def) {
+	ast_t *id = ast_first_child_of_type(def, TK_ID);
+	return id != nullptr ? ast_name(id) : nullptr;
+}
+
+static string lowercase(const string &s) {
+	string lower(s);
+	transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char) tolower(c); });
+	return lower;
+}
+
+/**
+ * @brief names of all types and their members, posted by trigram to narrow down substring queries
+ */
+class workspace_index_t {
+private:
+	vector<declaration_t> m_Declarations;
+	// declaration indices sorted by key
+	vector<uint32_t> m_Sorted;
+	// declaration indices containing a trigram, ascending
+	unordered_map<uint32_t, vector<uint32_t>> m_Trigrams;
+
+	void add(ast_t *def) {
+		const char *name = declaration_name(def);
+		if (name == nullptr)
+			return;
+
+		auto index = (uint32_t) m_Declarations.size();
+		m_Declarations.push_back(declaration_t{def, name, lowercase(name)});
+
+		const string &key = m_Declarations.back().key;
+		for (size_t i = 0; i + 3 <= key.size(); i++) {
+			auto &postings = m_Trigrams[trigram(key, i)];
+			// a name containing a trigram twice is posted once
+			if (postings.empty() || postings.back() != index)
+				postings.push_back(index);
+		}
+	}
+
+public:
+	explicit workspace_index_t(ast_t *program) {
+		for (ast_t *package = ast_child(program); package != nullptr; package = ast_sibling(package)) {
+			for (ast_t *module = ast_child(package); module != nullptr; module = ast_sibling(module)) {
+				for (ast_t *entity = ast_child(module); entity != nullptr; entity = ast_sibling(entity)) {
+					if (ast_id(entity) == TK_USE)
+						continue;
+					add(entity);
+
+					if (ast_id(entity) == TK_TYPE)
+						continue;
+					for (ast_t *member = ast_child(ast_childidx(entity, 4)); member != nullptr; member = ast_sibling(member))
+						add(member);
+				}
+			}
+		}
+
+		m_Sorted.resize(m_Declarations.size());
+		for (uint32_t i = 0; i < m_Sorted.size(); i++)
+			m_Sorted[i] = i;
+		sort(m_Sorted.begin(), m_Sorted.end(), [this](uint32_t a, uint32_t b) {
+			return m_Declarations[a].key < m_Declarations[b].key;
+		});
+	}
+
+	const declaration_t &declaration(uint32_t index) const { return m_Declarations[index]; }
+
+	size_t size() const { return m_Declarations.size(); }
+
+	const vector<uint32_t> &all() const { return m_Sorted; }
+
+	/**
+	 * @return declarations that could match query exactly, by prefix or as substring,
+	 * every such name contains all of the query's trigrams. Fuzzy matches need not be included.
+	 */
+	vector<uint32_t> candidates(const string &query) const {
+		// too short for trigrams
+		if (query.size() < 3)
+			return m_Sorted;
+
+		vector<const vector<uint32_t> *> lists;
+		for (size_t i = 0; i + 3 <= query.size(); i++) {
+			auto postings = m_Trigrams.find(trigram(query, i));
+			if (postings == m_Trigrams.end())
+				return {};
+			lists.push_back(&postings->second);
+		}
+
+		// intersect starting from the shortest list, so the candidates only ever shrink
+		sort(lists.begin(), lists.end(), [](const vector<uint32_t> *a, const vector<uint32_t> *b) {
+			return a->size() < b->size();
+		});
+
+		vector<uint32_t> candidates = *lists.front();
+		for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+			vector<uint32_t> narrowed;
+			set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(),
+			                 back_inserter(narrowed));
+			candidates.swap(narrowed);
+		}
+		return candidates;
+	}
+};
+
+// how well a name matches, lower is better
+enum class match_rank_t {
+	exact = 0,
+	prefix = 1,
+	substring = 2,
+	fuzzy = 3,
+	none = 4
+};
+
+static match_rank_t match(const string &key, const string &query) {
+	if (key == query)
+		return match_rank_t::exact;
+	if (key.compare(0, query.size(), query) == 0)
+		return match_rank_t::prefix;
+	if (key.find(query) != string::npos)
+		return match_rank_t::substring;
+
+	size_t matched = 0;
+	for (size_t i = 0; i < key.size() && matched < query.size(); i++)
+		if (key[i] == query[matched])
+			matched++;
+	return matched == query.size() ? match_rank_t::fuzzy : match_rank_t::none;
+}
+
+static unique_ptr<workspace_index_t> workspace_index;
+static ast_t *indexed_program = nullptr;
+
+void invalidate_workspace_symbols() {
+	workspace_index.reset();
+	indexed_program = nullptr;
+}
+
+static void add_symbol(Scope &scope, const declaration_t &declaration) {
+	ast_t *def = declaration.def;
+	Symbol *symbol = scope.add_symbols();
+	symbol->set_name(declaration.name);
+
+	SymbolKind kind;
+	if (SymbolKind_Parse(token_id_desc(ast_id(def)), &kind))
+		symbol->set_kind(kind);
+
+	SourceLocation *location = symbol->mutable_definition_location();
+	source_t *source = ast_source(def);
+	if (source != nullptr)
+		location->set_file(source->file);
+	location->set_line((uint32_t) ast_line(def));
+	location->set_column((uint32_t) ast_pos(def));
+
+	ast_t *docstring = ast_childlast(def);
+	if (ast_id(docstring) == TK_STRING)
+		symbol->set_docstring(ast_name(docstring));
+}
+
+void workspace_symbols_command(cli_opts_t &options, std::ostream &out) {
+	if (workspace_index == nullptr || indexed_program != options.program) {
+		workspace_index = make_unique<workspace_index_t>(options.program);
+		indexed_program = options.program;
+		LOG("indexed %zu declarations", workspace_index->size());
+	}
+
+	string key = lowercase(options.symbol_query);
+	if (!key.empty() && key.back() == '*')
+		key.pop_back();
+
+	struct ranked_t {
+		match_rank_t rank;
+		uint32_t index;
+	};
+
+	size_t wanted = options.limit > 0 ? options.limit : (size_t) 100;
+	vector<ranked_t> matches;
+	vector<bool> scored(workspace_index->size());
+	size_t substring_matches = 0;
+
+	auto score = [&](uint32_t index) {
+		if (scored[index])
+			return;
+		scored[index] = true;
+
+		match_rank_t rank = match(workspace_index->declaration(index).key, key);
+		if (rank == match_rank_t::none)
+			return;
+		matches.push_back(ranked_t{rank, index});
+		if (rank != match_rank_t::fuzzy)
+			substring_matches++;
+	};
+
+	for (uint32_t index : workspace_index->candidates(key))
+		score(index);
+
+	// fuzzy matches need a scan over every declaration, only do it when nothing contains the query
+	if (substring_matches == 0)
+		for (uint32_t index : workspace_index->all())
+			score(index);
+
+	// shorter names are closer to the query within a rank
+	auto better = [](const ranked_t &a, const ranked_t &b) {
+		const string &a_key = workspace_index->declaration(a.index).key;
+		const string &b_key = workspace_index->declaration(b.index).key;
+		if (a.rank != b.rank)
+			return a.rank < b.rank;
+		if (a_key.size() != b_key.size())
+			return a_key.size() < b_key.size();
+		return a_key < b_key;
+	};
+
+	size_t limit = min(matches.size(), wanted);
+	partial_sort(matches.begin(), matches.begin() + limit, matches.end(), better);
+
+	Scope scope;
+	for (size_t i = 0; i < limit; i++)
+		add_symbol(scope, workspace_index->declaration(matches[i].index));
+	scope.SerializeToOstream(&out);
+}